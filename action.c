@@ -166,6 +166,7 @@ pty_size(struct pty *p)
 {
 	check(p->fd == -1 || ! ioctl(p->fd, TIOCGWINSZ, &p->ws), errno = 0,
 		"ioctl error getting size of pty %d", IDX(p));
+	p->ws.ws_col = MIN(p->ws.ws_col, p->scr[0].cols);
 }
 
 void
@@ -216,6 +217,7 @@ reshape_root(void)
 	}
 	resize_pad(&S.werr, 1, COLS);
 	resize_pad(&S.wbkg, LINES, COLS);
+	resize_pad(&S.wpty, LINES, COLS);
 	reshape(S.root, 0, 0, LINES, COLS);
 }
 
@@ -233,7 +235,7 @@ void
 scrollh(const char *arg)
 {
 	struct canvas *n = S.f;
-	if (n && n->p && n->p->s && n->p->s->w) {
+	if (n && n->p && n->p->s) {
 		int c = S.count;
 		int count = c < 0 ? n->extent.x : !c ? n->p->ws.ws_col : c;
 		int x = n->offset.x + (*arg == '<' ? -count : count);
@@ -246,47 +248,45 @@ void
 scrolln(const char *arg)
 {
 	struct canvas *n = S.f;
-	if (n && n->p && n->p->s && n->p->s->w) {
+	if (n && n->p && n->p->s) {
 		int count = S.count == -1 ? n->extent.y - 1 : S.count;
 		int top = n->p->s->maxy - n->extent.y + 1;
+		/* Rows that spilled are above row 0 */
+		int bot = -spilled_rows(n->p->s);
 		n->offset.y += *arg == '-' ? -count : count;
-		n->offset.y = MIN(MAX(0, n->offset.y), top);
+		n->offset.y = MIN(MAX(bot, n->offset.y), top);
 	}
 }
 
 void
 send(const char *arg)
 {
-	rewrite(S.f->p->fd, arg + 1, arg[0]);
+	write_pty(S.f->p, arg + 1, arg[0]);
 	scrollbottom(S.f);
 }
 
 void
 send_cr(void)
 {
-	rewrite(S.f->p->fd, "\r\n", S.f->p->lnm ? 2 : 1);
+	write_pty(S.f->p, "\r\n", S.f->p->lnm ? 2 : 1);
 	scrollbottom(S.f);
 }
 
 static void
 grow_screens(struct pty *p, int siz)
 {
-	struct screen *s, *w[] = { &p->scr[0], &p->scr[1], NULL };
-	for (struct screen **sp = w; *sp && (s = *sp)->rows < siz; sp++) {
-		WINDOW *new = NULL;
-		if (resize_pad(&new, siz, p->ws.ws_col)) {
-			copywin(s->w, new, 0, 0, siz - s->rows, 0,
-				siz - 1, p->ws.ws_col - 1, 1);
-			delwin(s->w);
-			s->w = new;
-			wmove(s->w, s->c.y += siz - s->rows, s->c.x);
-			/* TODO?: mov maxy to struct pty */
-			s->maxy += siz - s->rows;
-			p->tos = MAX(0, s->maxy - p->ws.ws_row + 1);
-			s->scroll.top += siz - s->rows;
-			s->scroll.bot += siz - s->rows;
-			s->rows = siz;
-		}
+	/* Only the primary screen has history */
+	struct screen *s = p->scr;
+	int d = siz - s->rows;
+	/* A region of the whole screen still covers all of it */
+	int all = s->scroll.top == 0 && s->scroll.bot == s->rows - 1;
+	if (d > 0 && resize_screen(s, siz, s->cols)) {
+		s->c.y += d;
+		/* TODO?: mov maxy to struct pty */
+		s->maxy += d;
+		p->tos = MAX(0, p->s->maxy - p->ws.ws_row + 1);
+		s->scroll.top += all ? 0 : d;
+		s->scroll.bot += d;
 	}
 }
 
@@ -360,13 +360,12 @@ set_width(const char *arg)
 	if (w == -1) {
 		w = n->extent.x;
 	}
-	if (p->fd > 0 && (pty_size(p), w != p->ws.ws_col)) {
-		p->ws.ws_col = w;
-		resize_pad(&p->scr[0].w, p->scr[0].rows, w);
-		resize_pad(&p->scr[1].w, p->scr[1].rows, w);
-		if (p->s->c.x > w - 1) {
-			wmove(p->s->w, p->s->c.y, p->s->c.x = w - 1);
+	if (p->fd > 0 && w > 0 && (pty_size(p), w != p->ws.ws_col)) {
+		for (int i = 0; i < 2; i++) {
+			resize_screen(p->scr + i, p->scr[i].rows, w);
 		}
+		p->ws.ws_col = MIN(p->scr[0].cols, p->scr[1].cols);
+		p->s->c.x = MIN(p->s->c.x, p->ws.ws_col - 1);
 		set_tabs(p, p->tabstop);
 		reshape_window(p);
 	}
@@ -399,7 +398,7 @@ transition(const char *arg)
 {
 	switch (*arg++) {
 	case '*':
-		rewrite(S.f->p->fd, (char *)&S.ctlkey, 1);
+		write_pty(S.f->p, (char *)&S.ctlkey, 1);
 		break;
 	case '\n':
 		send_cr();
@@ -0,0 +1,139 @@
+/*
+ * Copyright 2020 - 2023 William Pursell <william.r.pursell@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Compare the event backends with many active ptys.  Each round
+ * writes a line to every one of n pipes and then waits and reads until
+ * all of them are drained, which is the pattern smtx sees when many
+ * panes are producing output at once.  The pipes are set with EV_DATA
+ * as the ptys are, so a backend that reads them itself saves the
+ * read(2) calls.
+ *
+ * usage: bench-events [-n panes] [-r rounds] [backend ...]
+ */
+#include "smtx.h"
+
+int
+check(int rv, int err, const char *fmt, ...)
+{
+	if (!rv) {
+		va_list ap;
+		va_start(ap, fmt);
+		vfprintf(stderr, fmt, ap);
+		va_end(ap);
+		fprintf(stderr, ": %s\n", strerror(err ? err : errno));
+	}
+	return !!rv;
+}
+
+static double
+now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static int
+run(const char *name, int n, int rounds)
+{
+	const char msg[] = "the quick brown fox jumps over the lazy dog\n";
+	int (*p)[2] = calloc(n, sizeof *p);
+	long waits = 0, reads = 0;
+	char buf[BUFSIZ];
+	double start;
+
+	if (p == NULL) {
+		err(EXIT_FAILURE, "calloc");
+	}
+	if (ev_init(name) == NULL) {
+		printf("%-10s unavailable\n", name);
+		free(p);
+		return 0;
+	}
+	for (int i = 0; i < n; i++) {
+		if (pipe(p[i]) == -1) {
+			err(EXIT_FAILURE, "pipe");
+		}
+		fcntl(p[i][0], F_SETFL, O_NONBLOCK);
+		if (!ev_set(p[i][0], EV_READ | EV_DATA, p[i])) {
+			errx(EXIT_FAILURE, "ev_set %d", p[i][0]);
+		}
+	}
+	start = now();
+	for (int r = 0; r < rounds; r++) {
+		int pending = n;
+		for (int i = 0; i < n; i++) {
+			if (write(p[i][1], msg, sizeof msg - 1) == -1) {
+				err(EXIT_FAILURE, "write");
+			}
+		}
+		while (pending > 0) {
+			struct event e[64];
+			int k = ev_wait(e, 64, -1);
+			waits += 1;
+			for (int i = 0; i < k; i++) {
+				int *q = e[i].data;
+				bool more = e[i].buf == NULL
+					|| e[i].len == EV_BUFSIZ;
+				reads += e[i].buf != NULL;
+				while (more && read(q[0], buf, sizeof buf) > 0) {
+					reads += 1;
+				}
+				pending -= 1;
+			}
+		}
+	}
+	double t = now() - start;
+	printf("%-10s %8.2f us/round %8.2f wakeups/round %8.2f reads/round\n",
+		name, 1e6 * t / rounds, (double)waits / rounds,
+		(double)reads / rounds);
+	for (int i = 0; i < n; i++) {
+		ev_set(p[i][0], 0, NULL);
+		close(p[i][0]);
+		close(p[i][1]);
+	}
+	free(p);
+	return 1;
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *all[] = { "select", "epoll", "io_uring", NULL };
+	int n = 128, rounds = 2000, c;
+
+	while ((c = getopt(argc, argv, "n:r:")) != -1) {
+		switch (c) {
+		case 'n': n = strtol(optarg, NULL, 10); break;
+		case 'r': rounds = strtol(optarg, NULL, 10); break;
+		default:
+			fprintf(stderr, "usage: %s [-n panes] [-r rounds] "
+				"[backend ...]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (n < 1 || rounds < 1) {
+		errx(EXIT_FAILURE, "invalid count");
+	}
+	printf("%d panes, %d rounds\n", n, rounds);
+	for (const char **b = optind < argc ? (const char **)argv + optind
+			: all; *b; b++) {
+		run(*b, n, rounds);
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,317 @@
+/*
+ * Copyright 2020 - 2023 William Pursell <william.r.pursell@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Measure the throughput of the parser and the screen handlers.  A single
+ * pty with no child is driven by vtwrite() while curses writes to
+ * /dev/null, so only the cost of parsing and updating the screen is seen.
+ * The functions below stand in for those of smtx that draw or write to a
+ * pty, so that the rest of smtx-main.c and curses input are not linked.
+ *
+ * Each corpus is either synthetic (text, ls, vim, htop, utf8, edit) or a file
+ * named on the command line, such as a session recorded with script(1).
+ * If SMTX_BENCH_MIN_MBS is set, exit with failure when any corpus is
+ * parsed more slowly than that many MB/s.  The peak resident size is
+ * reported so the cost of a long history can be compared.
+ *
+ * usage: bench-vtparser [-s history] [-S spill-dir] [-t seconds] [file ...]
+ */
+#include "smtx.h"
+#include <sys/resource.h>
+
+struct state S;
+
+void
+write_pty(struct pty *p, const char *b, size_t n)
+{
+	(void)p;
+	(void)b;
+	(void)n;
+}
+
+void
+set_width(const char *arg)
+{
+	(void)arg;
+}
+
+int
+build_layout(const char *layout)
+{
+	(void)layout;
+	return 0;
+}
+
+void
+show_status(const char *arg)
+{
+	(void)arg;
+}
+
+struct corpus {
+	const char *name;
+	char *b;
+	size_t len;
+};
+
+static double
+now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void __attribute__((format(printf,2,3)))
+emit(struct buf *b, const char *fmt, ...)
+{
+	char line[512];
+	va_list ap;
+	va_start(ap, fmt);
+	int n = vsnprintf(line, sizeof line, fmt, ap);
+	va_end(ap);
+	if (!buf_append(b, line, MIN(n, (int)sizeof line - 1))) {
+		err(EXIT_FAILURE, "buf_append");
+	}
+}
+
+#define CORPUS_SIZE (1 << 18)
+
+static void
+make_text(struct buf *b)
+{
+	for (int i = 0; b->len < CORPUS_SIZE; i++) {
+		emit(b, "2023-06-%02d 12:%02d:%02d INFO worker[%d]: processed "
+			"request %d for /api/v1/items in %d ms\n",
+			1 + i % 28, i % 60, i * 7 % 60, i % 16, i, i * 37 % 500);
+	}
+}
+
+static void
+make_ls(struct buf *b)
+{
+	for (int i = 0; b->len < CORPUS_SIZE; i++) {
+		emit(b, "\033[0m\033[01;34mdir%d\033[0m  \033[01;32mrun%d.sh"
+			"\033[0m  file%d.c  \033[01;36mlink%d\033[0m  "
+			"\033[01;31marchive%d.tar.gz\033[0m\n", i, i, i, i, i);
+	}
+}
+
+static void
+make_vim(struct buf *b)
+{
+	for (int i = 0; b->len < CORPUS_SIZE; i++) {
+		emit(b, "\033[?25l\033[H");
+		for (int y = 1; y < 24; y++) {
+			emit(b, "\033[%d;1H\033[33m%3d \033[m\033[38;5;%dmstatic"
+				"\033[m int\033[38;5;%dm f%d\033[m(\033[32m\"%d\""
+				"\033[m);\033[K", y, i + y, 100 + y % 50,
+				150 + i % 50, y, i);
+		}
+		emit(b, "\033[24;1H\033[7m main.c [+] %d,%d \033[m\033[K"
+			"\033[%d;5H\033[?25h", i % 23 + 1, i % 80, i % 23 + 1);
+	}
+}
+
+static void
+make_htop(struct buf *b)
+{
+	for (int i = 0; b->len < CORPUS_SIZE; i++) {
+		emit(b, "\033[1;1H\033[36m  CPU\033[1;30m[\033[32m%.*s"
+			"\033[31m%.*s\033[1;30m%*s]\033[m", i % 30,
+			"||||||||||||||||||||||||||||||", i % 7, "|||||||",
+			37 - i % 30 - i % 7, "");
+		for (int y = 5; y < 24; y++) {
+			emit(b, "\033[%d;1H\033[m%7d \033[36mroot\033[m     20   0 "
+				"\033[1m%6dM\033[m %5.1f \033[1;32mS\033[m %s"
+				"\033[K", y, 1000 + y * 17 + i, (i * y) % 4096,
+				(i * y % 1000) / 10.0, y % 3 ? "sshd" : "bash");
+		}
+	}
+}
+
+static void
+make_utf8(struct buf *b)
+{
+	static const char *words[] = {
+		"héllo", "wörld", "naïve", "日本語", "テキスト", "中文",
+		"Привет", "мир", "λόγος", "→", "☃", "✓", "😀", "ｆｕｌｌ",
+	};
+	int n = sizeof words / sizeof *words;
+	for (int i = 0; b->len < CORPUS_SIZE; i++) {
+		for (int j = 0; j < 8; j++) {
+			emit(b, "%s ", words[(i + j * 5) % n]);
+		}
+		emit(b, "%d\n", i);
+	}
+}
+
+/* Insert, delete and erase with counts larger than the line */
+static void
+make_edit(struct buf *b)
+{
+	for (int i = 0; b->len < CORPUS_SIZE; i++) {
+		emit(b, "\033[%d;%dH%s\033[%d;%dH\033[500P\033[500@\033[500X"
+			"\033[%dP\033[%d@\033[1K\033[1J", i % 24 + 1, i % 40 + 1,
+			"the quick brown fox jumps over the lazy dog",
+			i % 24 + 1, i % 40 + 1, i % 30 + 1, i % 30 + 1);
+	}
+}
+
+static void
+read_file(struct buf *b, const char *path)
+{
+	char chunk[BUFSIZ];
+	ssize_t r;
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		err(EXIT_FAILURE, "%s", path);
+	}
+	while ((r = read(fd, chunk, sizeof chunk)) > 0) {
+		if (!buf_append(b, chunk, r)) {
+			err(EXIT_FAILURE, "buf_append");
+		}
+	}
+	if (r == -1) {
+		err(EXIT_FAILURE, "%s", path);
+	}
+	close(fd);
+}
+
+static struct pty *
+new_bench_pty(int rows, int cols)
+{
+	struct pty *p = calloc(1, sizeof *p);
+	if (p == NULL) {
+		err(EXIT_FAILURE, "calloc");
+	}
+	p->ws.ws_row = 24;
+	if (!resize_screen(p->scr, rows, cols)
+			|| !resize_screen(p->scr + 1, p->ws.ws_row, cols)) {
+		errx(EXIT_FAILURE, "unable to create screens: %s", S.errmsg);
+	}
+	p->scr[1].maxy = p->ws.ws_row - 1;
+	if (S.spill && !spill_screen(p->scr, S.spill)) {
+		errx(EXIT_FAILURE, "unable to spill to %s: %s", S.spill,
+			S.errmsg);
+	}
+	p->ws.ws_col = cols;
+	p->tos = rows - p->ws.ws_row;
+	p->fd = -1;
+	p->tabstop = 8;
+	p->s = &p->scr[0];
+	tput(p, 0, 0, 0, NULL, ris);
+	p->vp.p = p;
+	vtreset(&p->vp);
+	S.p = p;
+	return p;
+}
+
+/* Parse the corpus repeatedly for at least secs seconds */
+static double
+run(struct pty *p, const struct corpus *c, double secs)
+{
+	size_t total = 0;
+	double start = now(), t;
+	do {
+		/* Feed in read sized chunks, as readpty does */
+		for (size_t off = 0; off < c->len; off += BUFSIZ) {
+			vtwrite(&p->vp, c->b + off, MIN(BUFSIZ, c->len - off));
+		}
+		total += c->len;
+	} while ((t = now() - start) < secs);
+	double mbs = total / t / 1e6;
+	printf("%-12s %9.1f MB/s %8.2f ns/byte\n", c->name, mbs,
+		1e9 * t / total);
+	return mbs;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct {
+		const char *name;
+		void (*make)(struct buf *);
+	} gen[] = {
+		{ "text", make_text },
+		{ "ls", make_ls },
+		{ "vim", make_vim },
+		{ "htop", make_htop },
+		{ "utf8", make_utf8 },
+		{ "edit", make_edit },
+	};
+	int history = 1024, c;
+	double secs = 0.25, min = 0, worst = -1;
+	const char *e = getenv("SMTX_BENCH_MIN_MBS");
+	const char *term = getenv("TERM");
+
+	while ((c = getopt(argc, argv, "s:S:t:")) != -1) {
+		switch (c) {
+		case 's': history = strtol(optarg, NULL, 10); break;
+		case 'S': S.spill = optarg; break;
+		case 't': secs = strtod(optarg, NULL); break;
+		default:
+			fprintf(stderr, "usage: %s [-s history] [-S spill-dir] "
+				"[-t seconds] [file ...]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	setlocale(LC_ALL, "");
+	FILE *null = fopen("/dev/null", "w");
+	if (null == NULL) {
+		err(EXIT_FAILURE, "/dev/null");
+	}
+	if (newterm(term && *term ? term : "vt100", null, stdin) == NULL
+			&& newterm("vt100", null, stdin) == NULL) {
+		errx(EXIT_FAILURE, "unable to initialize curses");
+	}
+	start_color();
+	use_default_colors();
+	struct pty *p = new_bench_pty(MAX(history, 24), 80);
+
+	printf("history %d, %s\n", history,
+		MB_CUR_MAX > 1 ? "multibyte locale" : "single byte locale");
+	int n = optind < argc ? argc - optind : (int)(sizeof gen / sizeof *gen);
+	for (int i = 0; i < n; i++) {
+		struct buf b = { 0 };
+		struct corpus k;
+		if (optind < argc) {
+			read_file(&b, k.name = argv[optind + i]);
+		} else {
+			gen[i].make(&b);
+			k.name = gen[i].name;
+		}
+		k.b = b.b;
+		k.len = b.len;
+		if (k.len > 0) {
+			double mbs = run(p, &k, secs);
+			worst = worst < 0 ? mbs : MIN(worst, mbs);
+		}
+		free(b.b);
+	}
+	endwin();
+	struct rusage u;
+	if (getrusage(RUSAGE_SELF, &u) == 0) {
+		printf("peak rss %ld kB\n", u.ru_maxrss);
+	}
+	if (e && (min = strtod(e, NULL)) > 0 && worst < min) {
+		fprintf(stderr, "throughput %.1f MB/s is below %.1f MB/s\n",
+			worst, min);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,682 @@
+/*
+ * Copyright 2020 - 2023 William Pursell <william.r.pursell@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Event backends.  A backend watches a set of file descriptors and
+ * reports the ready ones along with the data pointer given when the
+ * fd was registered.  epoll is preferred when available since its
+ * cost is proportional to the number of ready descriptors rather than
+ * to the value of the largest one, and it has no FD_SETSIZE ceiling.
+ * io_uring is available as an alternative on Linux that also does the
+ * reads for the caller, and select is kept as a portable fallback.
+ */
+#define _DEFAULT_SOURCE  /* syscall() */
+#include "smtx.h"
+#if HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+#endif
+#if HAVE_LINUX_IO_URING_H
+# include <linux/io_uring.h>
+# include <poll.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <sys/uio.h>
+#endif
+#if HAVE_SYS_SIGNALFD_H
+# include <sys/signalfd.h>
+#endif
+#include <sys/resource.h>
+
+struct backend {
+	const char *name;
+	int (*init)(void);
+	int (*set)(int fd, unsigned events);
+	int (*wait)(struct event *e, int n, int timeout);
+};
+
+static void **data;  /* data registered with each fd, indexed by fd */
+static int ndata;
+
+static int
+set_data(int fd, void *d)
+{
+	if (fd >= ndata) {
+		int n = MAX(fd + 1, 2 * ndata);
+		void **t = realloc(data, n * sizeof *data);
+		if (!check(t != NULL, errno = 0, "realloc")) {
+			return 0;
+		}
+		memset(t + ndata, 0, (n - ndata) * sizeof *t);
+		data = t;
+		ndata = n;
+	}
+	data[fd] = d;
+	return 1;
+}
+
+static rlim_t fd_ceiling = RLIM_INFINITY; /* Limit of the backend */
+
+static struct {
+	fd_set fds[2]; /* [0] == read, [1] == write */
+	int maxfd;
+} sel;
+
+static int
+sel_init(void)
+{
+	fd_ceiling = FD_SETSIZE;
+	FD_ZERO(sel.fds);
+	FD_ZERO(sel.fds + 1);
+	sel.maxfd = -1;
+	return 1;
+}
+
+static int
+sel_set(int fd, unsigned events)
+{
+	if (!check(fd < FD_SETSIZE, errno = 0, "fd %d >= FD_SETSIZE", fd)) {
+		return 0;
+	}
+	for (int i = 0; i < 2; i++) {
+		if (events & (EV_READ << i)) {
+			FD_SET(fd, sel.fds + i);
+		} else {
+			FD_CLR(fd, sel.fds + i);
+		}
+	}
+	sel.maxfd = MAX(sel.maxfd, events ? fd : -1);
+	while (sel.maxfd >= 0 && !FD_ISSET(sel.maxfd, sel.fds)
+			&& !FD_ISSET(sel.maxfd, sel.fds + 1)) {
+		sel.maxfd -= 1;
+	}
+	return 1;
+}
+
+static int
+sel_wait(struct event *e, int n, int timeout)
+{
+	fd_set f[2] = { sel.fds[0], sel.fds[1] };
+	struct timeval t = { timeout / 1000, timeout % 1000 * 1000 };
+	int r = select(sel.maxfd + 1, f, f + 1, NULL, timeout < 0 ? NULL : &t);
+	int k = 0;
+	for (int fd = 0; r > 0 && fd <= sel.maxfd && k < n; fd++) {
+		unsigned ev = (FD_ISSET(fd, f) ? EV_READ : 0)
+			| (FD_ISSET(fd, f + 1) ? EV_WRITE : 0);
+		if (ev) {
+			e[k++] = (struct event){ fd, ev, data[fd], NULL, 0 };
+		}
+	}
+	return r < 0 ? r : k;
+}
+
+/*
+ * pty ids are derived from their fd, so move the descriptors used
+ * internally into the top 16 of the range to keep them from
+ * consuming low ids.  The range ends at FD_SETSIZE under select.
+ */
+static int
+move_high(int fd)
+{
+	struct rlimit r;
+	int top, d;
+	if (fd != -1 && getrlimit(RLIMIT_NOFILE, &r) == 0
+			&& (r.rlim_cur = MIN(r.rlim_cur, fd_ceiling)) > 64
+			&& r.rlim_cur != RLIM_INFINITY
+			&& (top = r.rlim_cur - 16) > fd
+			&& (d = fcntl(fd, F_DUPFD_CLOEXEC, top)) != -1) {
+		close(fd);
+		fd = d;
+	}
+	return fd;
+}
+
+#if HAVE_SYS_EPOLL_H
+static int epfd = -1;
+
+static int
+ep_init(void)
+{
+	return (epfd = move_high(epoll_create1(EPOLL_CLOEXEC))) != -1;
+}
+
+static int
+ep_set(int fd, unsigned events)
+{
+	struct epoll_event e = { .data.fd = fd };
+	int rv;
+	e.events = (events & EV_READ ? EPOLLIN : 0)
+		| (events & EV_WRITE ? EPOLLOUT : 0);
+	if (events == 0) {
+		rv = epoll_ctl(epfd, EPOLL_CTL_DEL, fd, &e) == 0
+			|| errno == ENOENT;
+	} else if (!(rv = epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &e) == 0)
+			&& errno == ENOENT) {
+		rv = epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &e) == 0;
+	}
+	return check(rv, 0, "epoll_ctl %d", fd);
+}
+
+static int
+ep_wait(struct event *e, int n, int timeout)
+{
+	struct epoll_event ev[64];
+	int r = epoll_wait(epfd, ev, MIN(n, 64), timeout);
+	for (int i = 0; i < r; i++) {
+		int fd = ev[i].data.fd;
+		unsigned rd = EPOLLIN | EPOLLHUP | EPOLLERR;
+		e[i].fd = fd;
+		e[i].data = data[fd];
+		e[i].buf = NULL;
+		e[i].ev = (ev[i].events & rd ? EV_READ : 0)
+			| (ev[i].events & EPOLLOUT ? EV_WRITE : 0);
+	}
+	return r;
+}
+#endif
+
+#if defined IORING_FEAT_EXT_ARG && defined __NR_io_uring_setup
+/*
+ * An fd set with EV_DATA is given one of UR_SLOTS buffers, and a read
+ * into that buffer is kept outstanding in the ring, so that the output
+ * of any number of ptys arrives with the one io_uring_enter that waits
+ * for it instead of costing a read(2) each.  The buffer is reported
+ * with the event and left alone until the next ur_wait queues the next
+ * read.  The buffers are registered with the ring when the memory lock
+ * limit allows, which saves the kernel mapping them on every read.
+ * Other fds, and those set when no buffer is left, have a one-shot
+ * poll request outstanding instead.  Completed requests are re-armed
+ * by the same io_uring_enter that waits for the next batch.  The ring
+ * is driven directly through the system calls so that liburing is not
+ * required.
+ */
+#define UR_ENTRIES 256
+#define UR_SLOTS 128
+#define UR_IGNORE (~(__u64)0)
+#define UR_READ (1u << 31)  /* Set in the key of a read */
+#define UR_KEY(fd, gen) ((__u64)(gen) << 32 | (unsigned)(fd))
+static struct {
+	int fd;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array, sq_entries;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	unsigned pending;  /* sqes queued but not yet submitted */
+	char *buf;         /* UR_SLOTS buffers of EV_BUFSIZ bytes */
+	bool fixed;        /* buf is registered with the ring */
+	bool link;         /* Reads do not wait for data, so poll first */
+	bool used[UR_SLOTS];
+	int held[UR_SLOTS];  /* fds whose buffer was reported by ur_wait */
+	int nheld;
+	struct ur_fd {
+		unsigned want;   /* events requested with ev_set */
+		unsigned armed;  /* events of the outstanding poll, if any */
+		unsigned gen;    /* identifies the outstanding poll */
+		int slot;        /* 1 + the index of the buffer of fd, or 0 */
+		int reading;     /* 1: read outstanding, 2: buffer reported */
+		unsigned rgen;   /* identifies the outstanding read */
+	} *f;
+	int nf;
+} ur = { .fd = -1 };
+
+static int
+ur_enter(unsigned submit, unsigned wait, int timeout)
+{
+	struct __kernel_timespec ts = { timeout / 1000,
+		timeout % 1000 * 1000000 };
+	struct io_uring_getevents_arg a = { .ts = (uintptr_t)&ts };
+	unsigned flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+	int r;
+	if (timeout < 0) {
+		a.ts = 0;
+	}
+	r = wait ? syscall(__NR_io_uring_enter, ur.fd, submit, wait, flags,
+			&a, sizeof a)
+		: syscall(__NR_io_uring_enter, ur.fd, submit, 0, 0, NULL, 0);
+	if (r > 0) {
+		ur.pending -= MIN((unsigned)r, ur.pending);
+	}
+	return r;
+}
+
+static int
+sq_full(void)
+{
+	unsigned head = __atomic_load_n(ur.sq_head, __ATOMIC_ACQUIRE);
+	return *ur.sq_tail - head == ur.sq_entries;
+}
+
+static struct io_uring_sqe *
+ur_queue(int op, int fd, __u64 key)
+{
+	unsigned tail = *ur.sq_tail;
+	if (sq_full() && ur_enter(ur.pending, 0, 0) < 0) {
+		check(0, 0, "io_uring_enter");
+		return NULL;
+	}
+	if (!check(!sq_full(), EBUSY, "io_uring submission queue")) {
+		return NULL;
+	}
+	unsigned i = tail & *ur.sq_mask;
+	struct io_uring_sqe *s = ur.sqes + i;
+	memset(s, 0, sizeof *s);
+	s->opcode = op;
+	s->fd = fd;
+	s->user_data = key;
+	ur.sq_array[i] = i;
+	__atomic_store_n(ur.sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ur.pending += 1;
+	return s;
+}
+
+static int
+ur_poll(int fd, unsigned events, __u64 key, unsigned flags)
+{
+	struct io_uring_sqe *s = ur_queue(IORING_OP_POLL_ADD, fd, key);
+	if (s != NULL) {
+		s->flags = flags;
+		s->poll32_events = (events & EV_READ ? POLLIN : 0)
+			| (events & EV_WRITE ? POLLOUT : 0);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		s->poll32_events = s->poll32_events << 16
+			| s->poll32_events >> 16;
+#endif
+	}
+	return s != NULL;
+}
+
+static int
+ur_cancel(int op, __u64 key)
+{
+	struct io_uring_sqe *s = ur_queue(op, -1, UR_IGNORE);
+	if (s != NULL) {
+		s->addr = key;
+	}
+	return s != NULL;
+}
+
+/* The events to poll for on fd: all but those that a read waits for */
+static unsigned
+poll_events(const struct ur_fd *f)
+{
+	return f->want & (f->slot ? EV_WRITE : EV_READ | EV_WRITE);
+}
+
+static int
+ur_arm(int fd)
+{
+	struct ur_fd *f = ur.f + fd;
+	f->gen += 1;
+	f->armed = poll_events(f);
+	return ur_poll(fd, f->armed, UR_KEY(fd, f->gen), 0);
+}
+
+static int
+ur_read(int fd)
+{
+	struct ur_fd *f = ur.f + fd;
+	struct io_uring_sqe *s;
+	if (ur.link && !ur_poll(fd, EV_READ, UR_IGNORE, IOSQE_IO_LINK)) {
+		return 0;
+	}
+	s = ur_queue(ur.fixed ? IORING_OP_READ_FIXED : IORING_OP_READ, fd,
+		UR_KEY(fd | UR_READ, ++f->rgen));
+	if (s != NULL) {
+		s->addr = (uintptr_t)(ur.buf + (f->slot - 1) * EV_BUFSIZ);
+		s->len = EV_BUFSIZ;
+		s->off = (__u64)-1;  /* ptys do not seek */
+		f->reading = 1;
+	}
+	return s != NULL;
+}
+
+/* The buffer of fd is free: read into it again, or give it up */
+static int
+ur_next(int fd)
+{
+	struct ur_fd *f = ur.f + fd;
+	f->reading = 0;
+	if (f->want & EV_READ) {
+		return ur_read(fd);
+	}
+	ur.used[f->slot - 1] = false;
+	f->slot = 0;
+	return 1;
+}
+
+static int
+ur_slot(void)
+{
+	for (int i = 0; ur.buf != NULL && i < UR_SLOTS; i++) {
+		if (!ur.used[i]) {
+			ur.used[i] = true;
+			return i + 1;
+		}
+	}
+	return 0;
+}
+
+static void
+ur_buffers(void)
+{
+	struct iovec v = { NULL, UR_SLOTS * EV_BUFSIZ };
+	v.iov_base = mmap(NULL, v.iov_len, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (v.iov_base != MAP_FAILED) {
+		ur.buf = v.iov_base;
+		ur.fixed = syscall(__NR_io_uring_register, ur.fd,
+			IORING_REGISTER_BUFFERS, &v, 1) == 0;
+	}
+}
+
+static int
+ur_init(void)
+{
+	struct io_uring_params p;
+	size_t sl, cl;
+	char *sq = MAP_FAILED, *cq = MAP_FAILED;
+	int prot = PROT_READ | PROT_WRITE;
+
+	memset(&p, 0, sizeof p);
+	ur.fd = move_high(syscall(__NR_io_uring_setup, UR_ENTRIES, &p));
+	if (ur.fd == -1) {
+		return 0;
+	}
+	sl = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cl = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		sl = cl = MAX(sl, cl);
+	}
+	if ((p.features & IORING_FEAT_EXT_ARG)
+		&& (sq = mmap(NULL, sl, prot, MAP_SHARED, ur.fd,
+			IORING_OFF_SQ_RING)) != MAP_FAILED
+		&& (cq = (p.features & IORING_FEAT_SINGLE_MMAP) ? sq :
+			mmap(NULL, cl, prot, MAP_SHARED, ur.fd,
+			IORING_OFF_CQ_RING)) != MAP_FAILED
+		&& (ur.sqes = mmap(NULL, p.sq_entries * sizeof *ur.sqes,
+			prot, MAP_SHARED, ur.fd, IORING_OFF_SQES)) != MAP_FAILED
+	) {
+		ur.sq_head = (unsigned *)(sq + p.sq_off.head);
+		ur.sq_tail = (unsigned *)(sq + p.sq_off.tail);
+		ur.sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+		ur.sq_array = (unsigned *)(sq + p.sq_off.array);
+		ur.sq_entries = p.sq_entries;
+		ur.cq_head = (unsigned *)(cq + p.cq_off.head);
+		ur.cq_tail = (unsigned *)(cq + p.cq_off.tail);
+		ur.cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+		ur.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+		ur_buffers();
+		return 1;
+	}
+	if (sq != MAP_FAILED) {
+		munmap(sq, sl);
+	}
+	if (cq != MAP_FAILED && cq != sq) {
+		munmap(cq, cl);
+	}
+	close(ur.fd);
+	return ur.fd = -1, 0;
+}
+
+/*
+ * A read is cancelled only when fd is removed from the set, since its
+ * data could not be reported.  Otherwise an outstanding read is left
+ * to complete, and its data reported, even if EV_READ was cleared.
+ */
+static int
+ur_set(int fd, unsigned events)
+{
+	if (fd >= ur.nf) {
+		int n = MAX(fd + 1, 2 * ur.nf);
+		struct ur_fd *t = realloc(ur.f, n * sizeof *t);
+		if (!check(t != NULL, errno = 0, "realloc")) {
+			return 0;
+		}
+		memset(t + ur.nf, 0, (n - ur.nf) * sizeof *t);
+		ur.f = t;
+		ur.nf = n;
+	}
+	struct ur_fd *f = ur.f + fd;
+	unsigned pe;
+	f->want = events;
+	if (f->slot == 0 && (events & EV_READ) && (events & EV_DATA)) {
+		f->slot = ur_slot();
+	}
+	if (f->slot && f->reading == 0 && !ur_next(fd)) {
+		return 0;
+	}
+	if (f->slot && f->reading == 1 && events == 0
+			&& !ur_cancel(IORING_OP_ASYNC_CANCEL,
+			UR_KEY(fd | UR_READ, f->rgen++))) {
+		return 0;
+	}
+	if (f->armed == (pe = poll_events(f))) {
+		return 1;
+	}
+	if (f->armed && !ur_cancel(IORING_OP_POLL_REMOVE,
+			UR_KEY(fd, f->gen))) {
+		return 0;
+	}
+	f->armed = 0;
+	return pe == 0 || ur_arm(fd);
+}
+
+/*
+ * A request that fails for want of resources or is cancelled by the
+ * kernel is re-armed without being reported.  Older kernels also fail
+ * reads from an empty O_NONBLOCK fd rather than waiting, in which case
+ * each read from then on is linked behind a poll.  Any other error,
+ * and the end of file, is reported as readable without a buffer so
+ * that the owner of the fd sees it on read, and the fd is dropped (or
+ * only stops being read) until it is set again.
+ */
+static int
+transient(int err)
+{
+	return err == EINTR || err == EAGAIN || err == ENOMEM
+		|| err == ECANCELED;
+}
+
+static int
+read_done(int fd, const struct io_uring_cqe *c, struct event *e)
+{
+	struct ur_fd *f = ur.f + fd;
+	if (f->rgen != c->user_data >> 32 || (c->res < 0
+			&& transient(-c->res))) {
+		ur.link |= c->res == -EAGAIN;
+		ur_next(fd);  /* A cancelled or failed read */
+		return 0;
+	}
+	if (c->res > 0) {
+		f->reading = 2;
+		ur.held[ur.nheld++] = fd;
+		*e = (struct event){ fd, EV_READ, data[fd],
+			ur.buf + (f->slot - 1) * EV_BUFSIZ, c->res };
+	} else {
+		f->want &= ~EV_READ;
+		ur_next(fd);
+		*e = (struct event){ fd, EV_READ, data[fd], NULL, 0 };
+	}
+	return 1;
+}
+
+static int
+ur_wait(struct event *e, int n, int timeout)
+{
+	unsigned head;
+	int k = 0;
+	for (int i = 0; i < ur.nheld; i++) {
+		ur_next(ur.held[i]);  /* The caller is done with the buffer */
+	}
+	ur.nheld = 0;
+	head = *ur.cq_head;
+	if (head == __atomic_load_n(ur.cq_tail, __ATOMIC_ACQUIRE)
+			&& ur_enter(ur.pending, 1, timeout) < 0
+			&& errno != ETIME) {
+		return -1;
+	}
+	unsigned tail = __atomic_load_n(ur.cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail && k < n; head++) {
+		struct io_uring_cqe *c = ur.cqes + (head & *ur.cq_mask);
+		int fd = c->user_data & ~UR_READ & 0xffffffff;
+		struct ur_fd *f = fd < ur.nf ? ur.f + fd : NULL;
+		if (c->user_data == UR_IGNORE || !f) {
+			continue;
+		} else if (c->user_data & UR_READ) {
+			k += read_done(fd, c, e + k);
+			continue;
+		} else if (!f->armed || f->gen != c->user_data >> 32) {
+			continue;  /* A cancelled or superseded poll */
+		}
+		f->armed = 0;
+		if (c->res < 0 && !transient(-c->res)) {
+			f->want = 0;
+			e[k++] = (struct event){ fd, EV_READ, data[fd],
+				NULL, 0 };
+		} else if (c->res >= 0) {
+			unsigned r = c->res;
+			e[k++] = (struct event){ fd,
+				(r & (POLLIN | POLLHUP | POLLERR) ? EV_READ : 0)
+				| (r & POLLOUT ? EV_WRITE : 0), data[fd],
+				NULL, 0 };
+		}
+		if (poll_events(f)) {
+			ur_arm(fd);
+		}
+	}
+	__atomic_store_n(ur.cq_head, head, __ATOMIC_RELEASE);
+	return k;
+}
+#endif
+
+static const struct backend backends[] = {
+#if HAVE_SYS_EPOLL_H
+	{ "epoll", ep_init, ep_set, ep_wait },
+#endif
+#if defined IORING_FEAT_EXT_ARG && defined __NR_io_uring_setup
+	{ "io_uring", ur_init, ur_set, ur_wait },
+#endif
+	{ "select", sel_init, sel_set, sel_wait },
+	{ NULL, NULL, NULL, NULL }
+};
+static const struct backend *be;
+
+/*
+ * Select the named backend, or if name is NULL the first backend that
+ * initializes successfully.
+ */
+const char *
+ev_init(const char *name)
+{
+	for (be = backends; be->name; be++) {
+		if ((name == NULL || !strcmp(name, be->name)) && be->init()) {
+			break;
+		}
+	}
+	return check(be->name != NULL, 0, "event backend %s unavailable",
+		name ? name : "") ? be->name : NULL;
+}
+
+/*
+ * Register interest in events on fd.  If events is 0, fd is removed
+ * from the set.  data is returned with each event on fd.  With EV_DATA,
+ * a backend that can read fd itself may report EV_READ with the bytes
+ * it read in buf, which stays valid until the next call to ev_wait.
+ */
+int
+ev_set(int fd, unsigned events, void *d)
+{
+	return check(fd >= 0, errno = 0, "invalid fd %d", fd)
+		&& set_data(fd, events ? d : NULL)
+		&& be->set(fd, events);
+}
+
+/*
+ * Wait up to timeout milliseconds (forever if timeout < 0) and store
+ * at most n ready events in e.  Returns the number of events stored,
+ * or -1 on error.
+ */
+int
+ev_wait(struct event *e, int n, int timeout)
+{
+	return be->wait(e, n, timeout);
+}
+
+/*
+ * Signals are delivered as events: the signals in set are reported as
+ * readable on the fd returned by ev_signal, and ev_getsig returns them
+ * one at a time (0 when none remain).  A signalfd is used where
+ * available, otherwise a handler writes the signal number to a pipe.
+ */
+static int sigfd = -1;
+#if !HAVE_SYS_SIGNALFD_H
+static int sigpipe = -1;
+
+static void
+catch(int sig)
+{
+	unsigned char c = sig;
+	int e = errno;
+	(void)!write(sigpipe, &c, 1);
+	errno = e;
+}
+#endif
+
+int
+ev_signal(const sigset_t *set)
+{
+#if HAVE_SYS_SIGNALFD_H
+	if (check(sigprocmask(SIG_BLOCK, set, NULL) == 0, 0, "sigprocmask")) {
+		sigfd = move_high(signalfd(-1, set, SFD_NONBLOCK | SFD_CLOEXEC));
+	}
+	return check(sigfd != -1, 0, "signalfd") ? sigfd : -1;
+#else
+	int p[2];
+	struct sigaction sa;
+	if (!check(pipe(p) == 0, 0, "pipe")) {
+		return -1;
+	}
+	sigfd = move_high(p[0]);
+	sigpipe = move_high(p[1]);
+	for (int i = 0; i < 2; i++) {
+		int fd = i ? sigpipe : sigfd;
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+	}
+	memset(&sa, 0, sizeof sa);
+	sa.sa_handler = catch;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	for (int i = 1; i < NSIG; i++) {
+		if (sigismember(set, i) == 1) {
+			sigaction(i, &sa, NULL);
+		}
+	}
+	return sigfd;
+#endif
+}
+
+int
+ev_getsig(void)
+{
+#if HAVE_SYS_SIGNALFD_H
+	struct signalfd_siginfo s;
+	return read(sigfd, &s, sizeof s) == sizeof s ? (int)s.ssi_signo : 0;
+#else
+	unsigned char c;
+	return read(sigfd, &c, 1) == 1 ? c : 0;
+#endif
+}
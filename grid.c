@@ -0,0 +1,707 @@
+/*
+ * Copyright 2020 - 2023 William Pursell <william.r.pursell@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Screens are kept as grids of cells rather than curses pads.  Pads
+ * shift every row when they scroll and are limited to the range of a
+ * short, while the rows of a grid are a ring, so scrolling the whole
+ * screen is a change of origin and scrolling a region only exchanges
+ * rows.  Curses is used only to draw the part of a screen that is
+ * visible in a canvas.
+ *
+ * Most of a long history is never looked at again, so a row that is
+ * HOT_ROWS above the cursor is frozen: its cells are compressed and
+ * freed.  A frozen row is a count of cells followed by runs, each a
+ * header of (length << 1 | fill), attributes and colors, and then the
+ * characters of the run, or a single character repeated length times
+ * if fill is set.  All numbers are stored 7 bits per byte, so a row of
+ * ASCII text costs little more than its text.  Colors are kept rather
+ * than the color pair, which may be freed and reused while the row is
+ * frozen, and the pair is looked up again when the row is expanded.
+ * A frozen row is thawed when it is written to, and expanded into a
+ * scratch buffer when it is only read (see peek_row).  Rows that have
+ * never been written share empty_row.
+ *
+ * Rows are frozen in batches (see freeze_rows), once per frame or when
+ * FREEZE_BATCH rows above the hot rows are waiting, so that a flood of
+ * output that scrolls rows out of a short history between frames does
+ * not compress them at all.  Rows 0 through frozen - 1 are known to be
+ * frozen, so a batch starts where the last one ended.
+ *
+ * If a screen spills (see spill_screen), rows that scroll off the top
+ * are appended in the same form to segment files that are mapped into
+ * memory, and read back as rows -1, -2, ... above the top of the
+ * screen.  The files are unlinked as soon as they are created.  When a
+ * screen has SEGMENTS_MAX segments, the oldest is dropped.
+ */
+#include "smtx.h"
+#include <sys/mman.h>
+
+#define HOT_ROWS 256
+#define FREEZE_BATCH 1024
+#define MIN_FILL 4
+#define SEGMENT_SIZE (1 << 22)
+#define SEGMENTS_MAX 64
+
+struct spill {
+	const char *dir;
+	unsigned char *seg[SEGMENTS_MAX]; /* Mapped segments, oldest first */
+	int nseg;
+	size_t base;  /* Offset of seg[0] */
+	size_t end;   /* Offset of the next row */
+	size_t *row;  /* Offsets of the rows, oldest at row[first] */
+	size_t first, count, siz;
+};
+
+static const struct cell blank = { L' ', A_NORMAL, 0 };
+static unsigned char empty_row[1]; /* Zero cells, padded with blanks */
+static struct cell *lost; /* Written instead of a row that cannot thaw */
+static int lost_cols;
+
+static struct row *
+slot(struct screen *s, int y)
+{
+	return s->line + (s->org + y) % s->rows;
+}
+
+static int
+same(const struct cell *a, const struct cell *b)
+{
+	return a->c == b->c && a->a == b->a && a->p == b->p;
+}
+
+static unsigned char *
+put_num(unsigned char *d, unsigned long v)
+{
+	for (; v > 0x7f; v >>= 7) {
+		*d++ = 0x80 | (v & 0x7f);
+	}
+	*d++ = v;
+	return d;
+}
+
+static const unsigned char *
+get_num(const unsigned char *z, unsigned long *v)
+{
+	int shift = 0;
+	*v = 0;
+	do {
+		*v |= (unsigned long)(*z & 0x7f) << shift;
+		shift += 7;
+	} while (*z++ & 0x80);
+	return z;
+}
+
+/* Store pair p as 0 for the default pair, or as its colors */
+static unsigned char *
+put_colors(unsigned char *d, short p)
+{
+	int color[2];
+	if (p == 0) {
+		return put_num(d, 0);
+	}
+	pair_colors(p, color);
+	d = put_num(d, MAX(color[0], -1) + 2);
+	return put_num(d, MAX(color[1], -1) + 1);
+}
+
+/* Read a pair stored by put_pair, or skip it if p is NULL */
+static const unsigned char *
+get_colors(const unsigned char *z, unsigned long *p)
+{
+	unsigned long fg, bg = 0;
+	z = get_num(z, &fg);
+	if (fg > 0) {
+		z = get_num(z, &bg);
+	}
+	if (p) {
+		*p = fg ? color_pair((int)fg - 2, (int)bg - 1) : 0;
+	}
+	return z;
+}
+
+/* Compress the n cells of c into d, which has room for 16 * n + 8 bytes */
+static size_t
+compress_row(unsigned char *d, const struct cell *c, int n)
+{
+	unsigned char *start = d;
+	d = put_num(d, n);
+	for (int i = 0, j; i < n; i = j) {
+		for (j = i + 1; j < n && same(c + j, c + i); j++) {
+			;
+		}
+		int fill = j - i >= MIN_FILL;
+		if (!fill) {
+			/* Extend the run up to the next change of attributes
+			or the start of a fill */
+			int rep = 1;
+			for (j = i + 1; j < n && c[j].a == c[i].a
+					&& c[j].p == c[i].p; j++) {
+				rep = same(c + j, c + j - 1) ? rep + 1 : 1;
+				if (rep == MIN_FILL) {
+					j -= MIN_FILL - 1;
+					break;
+				}
+			}
+		}
+		d = put_num(d, (unsigned long)(j - i) << 1 | fill);
+		d = put_num(d, c[i].a);
+		d = put_colors(d, c[i].p);
+		for (int k = i; k < (fill ? i + 1 : j); k++) {
+			d = put_num(d, c[k].c);
+		}
+	}
+	return d - start;
+}
+
+/* Expand z into the cols cells of c, truncating or padding with blanks */
+static void
+expand_row(struct cell *c, int cols, const unsigned char *z)
+{
+	unsigned long n, len, a, p, w = L' ';
+	int x = 0;
+	for (z = get_num(z, &n); n > 0; n -= MIN(n, len >> 1)) {
+		z = get_num(z, &len);
+		z = get_num(z, &a);
+		z = get_colors(z, &p);
+		for (unsigned long i = 0; i < len >> 1; i++) {
+			if (i == 0 || !(len & 1)) {
+				z = get_num(z, &w);
+			}
+			if (x < cols) {
+				c[x++] = (struct cell){ w, a, p };
+			}
+		}
+	}
+	while (x < cols) {
+		c[x++] = blank;
+	}
+}
+
+/* Return the length of the compressed row z */
+static size_t
+row_len(const unsigned char *z)
+{
+	const unsigned char *e = z;
+	unsigned long n, len, v;
+	for (e = get_num(e, &n); n > 0; n -= MIN(n, len >> 1)) {
+		e = get_num(e, &len);
+		e = get_num(e, &v);
+		e = get_colors(e, NULL);
+		for (unsigned long i = 0; i < (len & 1 ? 1 : len >> 1); i++) {
+			e = get_num(e, &v);
+		}
+	}
+	return e - z;
+}
+
+/* Return a buffer with room for a compressed row of cols cells */
+static unsigned char *
+row_buf(int cols)
+{
+	static unsigned char *buf;
+	static size_t siz;
+	size_t need = 16 * (size_t)cols + 8;
+	if (need > siz) {
+		unsigned char *t = realloc(buf, need);
+		if (t == NULL) {
+			return NULL;
+		}
+		buf = t;
+		siz = need;
+	}
+	return buf;
+}
+
+static void
+drop_frozen(struct row *r)
+{
+	if (r->z != empty_row) {
+		free(r->z);
+	}
+	r->z = NULL;
+}
+
+static void
+freeze(struct screen *s, struct row *r)
+{
+	unsigned char *buf;
+	size_t n;
+	int x = 0;
+
+	while (x < s->cols && same(r->c + x, &blank)) {
+		x += 1;
+	}
+	if (x < s->cols) {
+		if ((buf = row_buf(s->cols)) == NULL) {
+			return;
+		}
+		n = compress_row(buf, r->c, s->cols);
+		if ((r->z = malloc(n)) == NULL) {
+			return;
+		}
+		memcpy(r->z, buf, n);
+	} else {
+		r->z = empty_row;
+	}
+	if (s->spare == NULL) {
+		s->spare = r->c;
+	} else {
+		free(r->c);
+	}
+	r->c = NULL;
+}
+
+static void
+thaw(struct screen *s, struct row *r)
+{
+	struct cell *c = s->spare;
+	if (c == NULL && !check((c = malloc(s->cols * sizeof *c)) != NULL,
+			ENOMEM, "row of %d cells", s->cols)) {
+		return;
+	}
+	s->spare = NULL;
+	expand_row(c, s->cols, r->z);
+	drop_frozen(r);
+	r->c = c;
+}
+
+/* Return row y of s for writing */
+struct cell *
+get_row(struct screen *s, int y)
+{
+	struct row *r = slot(s, y);
+	if (r->c == NULL) {
+		thaw(s, r);
+		s->frozen = MIN(s->frozen, y);
+	}
+	return r->c ? r->c : lost;
+}
+
+/* Return row y of s, or NULL if it is frozen */
+const struct cell *
+hot_row(struct screen *s, int y)
+{
+	return slot(s, y)->c;
+}
+
+static const unsigned char *
+spilled_row(struct screen *s, int y)
+{
+	struct spill *sp = s->spill;
+	if (sp == NULL || y < -(long)sp->count) {
+		return empty_row;
+	}
+	size_t off = sp->row[sp->first + sp->count + y] - sp->base;
+	return sp->seg[off / SEGMENT_SIZE] + off % SEGMENT_SIZE;
+}
+
+/*
+ * Return row y of s for reading.  It is valid until the next call.
+ * Negative rows are read from the spill, and are blank beyond it.
+ */
+const struct cell *
+peek_row(struct screen *s, int y)
+{
+	static struct cell *buf;
+	static int siz;
+	struct row *r = y < 0 ? NULL : slot(s, y);
+	if (r && r->c) {
+		return r->c;
+	}
+	if (s->cols > siz) {
+		struct cell *t = realloc(buf, s->cols * sizeof *t);
+		if (t == NULL) {
+			return lost;
+		}
+		buf = t;
+		siz = s->cols;
+	}
+	expand_row(buf, s->cols, r ? r->z : spilled_row(s, y));
+	return buf;
+}
+
+/* Spill rows that scroll off the top of s into files in dir */
+int
+spill_screen(struct screen *s, const char *dir)
+{
+	if (s->spill == NULL && !check((s->spill = calloc(1, sizeof
+			*s->spill)) != NULL, ENOMEM, "spill")) {
+		return 0;
+	}
+	s->spill->dir = dir;
+	return 1;
+}
+
+int
+spilled_rows(const struct screen *s)
+{
+	return s->spill ? (int)MIN(s->spill->count, INT_MAX) : 0;
+}
+
+static void
+drop_segment(struct spill *sp)
+{
+	munmap(sp->seg[0], SEGMENT_SIZE);
+	memmove(sp->seg, sp->seg + 1, --sp->nseg * sizeof *sp->seg);
+	sp->base += SEGMENT_SIZE;
+	while (sp->count > 0 && sp->row[sp->first] < sp->base) {
+		sp->first += 1;
+		sp->count -= 1;
+	}
+}
+
+/* Forget all the rows in the spill of s */
+void
+drop_spill(struct screen *s)
+{
+	struct spill *sp = s->spill;
+	if (sp) {
+		while (sp->nseg > 0) {
+			drop_segment(sp);
+		}
+		sp->base = sp->end = 0;
+		sp->first = sp->count = 0;
+	}
+}
+
+static int
+add_segment(struct spill *sp)
+{
+	char path[PATH_MAX];
+	void *m = MAP_FAILED;
+	int fd;
+
+	if (sp->nseg == SEGMENTS_MAX) {
+		drop_segment(sp);
+	}
+	snprintf(path, sizeof path, "%s/smtx-XXXXXX", sp->dir);
+	if (check((fd = mkstemp(path)) != -1, 0, "%s", path)) {
+		unlink(path);
+		if (check(ftruncate(fd, SEGMENT_SIZE) == 0, 0, "%s", path)) {
+			m = mmap(NULL, SEGMENT_SIZE, PROT_READ | PROT_WRITE,
+				MAP_SHARED, fd, 0);
+			check(m != MAP_FAILED, 0, "mmap %s", path);
+		}
+		close(fd);
+	}
+	if (m == MAP_FAILED) {
+		sp->dir = NULL; /* Stop spilling */
+		return 0;
+	}
+	sp->seg[sp->nseg++] = m;
+	return 1;
+}
+
+static void
+spill(struct screen *s, struct row *r)
+{
+	struct spill *sp = s->spill;
+	const unsigned char *z = r->z;
+	size_t n;
+
+	if (sp->dir == NULL) {
+		return;
+	}
+	if (r->c) {
+		unsigned char *buf = row_buf(s->cols);
+		if (buf == NULL) {
+			return;
+		}
+		n = compress_row(buf, r->c, s->cols);
+		z = buf;
+	} else {
+		n = row_len(z);
+	}
+	if ((sp->end - sp->base) % SEGMENT_SIZE + n > SEGMENT_SIZE
+			|| sp->end - sp->base >= sp->nseg * (size_t)SEGMENT_SIZE) {
+		/* Rows do not cross segments */
+		sp->end = sp->base + sp->nseg * (size_t)SEGMENT_SIZE;
+		if (!add_segment(sp)) {
+			return;
+		}
+	}
+	if (sp->first + sp->count == sp->siz) {
+		if (sp->first > sp->siz / 2) {
+			memmove(sp->row, sp->row + sp->first,
+				sp->count * sizeof *sp->row);
+			sp->first = 0;
+		} else {
+			size_t siz = MAX(1024, 2 * sp->siz);
+			size_t *t = realloc(sp->row, siz * sizeof *t);
+			if (!check(t != NULL, ENOMEM, "spill index")) {
+				return;
+			}
+			sp->row = t;
+			sp->siz = siz;
+		}
+	}
+	size_t off = sp->end - sp->base;
+	memcpy(sp->seg[off / SEGMENT_SIZE] + off % SEGMENT_SIZE, z, n);
+	sp->row[sp->first + sp->count++] = sp->end;
+	sp->end += n;
+}
+
+/*
+ * Freeze the rows more than HOT_ROWS above the cursor that are not yet
+ * known to be frozen, if there are at least FREEZE_BATCH of them or all
+ * is set.
+ */
+void
+freeze_rows(struct screen *s, bool all)
+{
+	int y = s->c.y - HOT_ROWS;
+	if (y - s->frozen >= (all ? 0 : FREEZE_BATCH)) {
+		for (; s->frozen <= y; s->frozen++) {
+			if (slot(s, s->frozen)->c != NULL) {
+				freeze(s, slot(s, s->frozen));
+			}
+		}
+	}
+}
+
+/*
+ * Add d blank rows to the top of s.  The line array grows by doubling,
+ * and the new rows are opened in the ring just before the top row, so
+ * only the rows from org to the end of the array are moved.
+ */
+static int
+grow_rows(struct screen *s, int d)
+{
+	if (s->rows + d > s->cap) {
+		int cap = MAX(s->rows + d, 2 * s->cap);
+		struct row *t = realloc(s->line, sizeof *t * cap);
+		if (!check(t != NULL, ENOMEM, "screen of %d rows", cap)) {
+			return 0;
+		}
+		s->line = t;
+		s->cap = cap;
+	}
+	memmove(s->line + s->org + d, s->line + s->org,
+		sizeof *s->line * (s->rows - s->org));
+	for (int i = 0; i < d; i++) {
+		s->line[s->org + i] = (struct row){ NULL, empty_row };
+	}
+	s->rows += d;
+	s->frozen += d;
+	return 1;
+}
+
+/*
+ * Resize s to rows x cols.  The bottom rows of the old grid are kept
+ * at the bottom of the new one, truncated or padded with blanks.  Rows
+ * are moved rather than copied unless the width changes.
+ */
+int
+resize_screen(struct screen *s, int rows, int cols)
+{
+	int d = rows - s->rows;
+	if (cols == s->cols && d >= 0) {
+		return grow_rows(s, d);
+	}
+	struct row *line = malloc(sizeof *line * rows);
+
+	if (cols > lost_cols) {
+		struct cell *t = realloc(lost, cols * sizeof *t);
+		if (t != NULL) {
+			lost = t;
+			lost_cols = cols;
+		}
+	}
+	if (!check(line && cols <= lost_cols, ENOMEM, "screen of %d rows",
+			rows)) {
+		free(line);
+		return 0;
+	}
+	for (int y = 0; y < rows; y++) {
+		line[y] = (struct row){ NULL, empty_row };
+		if (y >= d && y - d < s->rows && slot(s, y - d)->c
+				&& cols != s->cols) {
+			struct cell *c = malloc(cols * sizeof *c);
+			if (!check(c != NULL, ENOMEM, "row of %d cells", cols)) {
+				while (y-- > 0) {
+					free(line[y].c);
+				}
+				free(line);
+				return 0;
+			}
+			line[y].c = c;
+		}
+	}
+	for (int y = 0; y < s->rows; y++) {
+		struct row *r = slot(s, y), *n = y + d >= 0 ? line + y + d : NULL;
+		if (n && r->c && n->c) {
+			int x = MIN(cols, s->cols);
+			memcpy(n->c, r->c, x * sizeof *r->c);
+			while (x < cols) {
+				n->c[x++] = blank;
+			}
+			free(r->c);
+		} else if (n) {
+			*n = *r;
+		} else {
+			free(r->c);
+			drop_frozen(r);
+		}
+	}
+	if (cols != s->cols) {
+		free(s->spare);
+		s->spare = NULL;
+	}
+	free(s->line);
+	s->line = line;
+	s->rows = s->cap = rows;
+	s->cols = cols;
+	s->org = 0;
+	s->frozen = 0;
+	return 1;
+}
+
+void
+free_screen(struct screen *s)
+{
+	for (int y = 0; y < s->rows; y++) {
+		free(s->line[y].c);
+		drop_frozen(s->line + y);
+	}
+	free(s->line);
+	free(s->spare);
+	drop_spill(s);
+	if (s->spill) {
+		free(s->spill->row);
+		free(s->spill);
+	}
+	s->line = NULL;
+	s->spare = NULL;
+	s->spill = NULL;
+	s->rows = s->cap = s->frozen = 0;
+}
+
+void
+set_scroll(struct screen *s, int top, int bottom)
+{
+	if (top >= 0 && top < bottom && bottom < s->rows) {
+		s->scroll.top = top;
+		s->scroll.bot = bottom;
+	}
+}
+
+/* Fill rows top through bot with the background */
+void
+clear_rows(struct screen *s, int top, int bot)
+{
+	for (int y = MAX(0, top); y <= bot && y < s->rows; y++) {
+		struct row *r = slot(s, y);
+		if (r->c == NULL && same(&s->c.bkg, &blank)) {
+			drop_frozen(r);
+			r->z = empty_row;
+		} else {
+			struct cell *c = get_row(s, y);
+			for (int x = 0; x < s->cols; x++) {
+				c[x] = s->c.bkg;
+			}
+		}
+	}
+}
+
+static void
+reverse_rows(struct screen *s, int a, int b)
+{
+	for (; a < b; a++, b--) {
+		struct row t = *slot(s, a);
+		*slot(s, a) = *slot(s, b);
+		*slot(s, b) = t;
+	}
+}
+
+/*
+ * Scroll rows top through bot up n rows, or down if n is negative.
+ * The rows scrolled in are cleared.
+ */
+void
+scroll_screen(struct screen *s, int top, int bot, int n)
+{
+	int h = bot - top + 1;
+	int k = n < 0 ? -n : n;
+	if (top < 0 || bot >= s->rows || h < 1 || n == 0) {
+		return;
+	}
+	if (n > 0 && h == s->rows && s->spill) {
+		for (int y = 0; y < MIN(k, h); y++) {
+			spill(s, slot(s, y));
+		}
+	}
+	if (k < h) {
+		if (h == s->rows) {
+			s->org = (s->org + (n > 0 ? k : h - k)) % s->rows;
+			s->frozen = n > 0 ? MAX(0, s->frozen - k) : 0;
+		} else {
+			/* Rotate the region by reversing both parts, then all */
+			int m = n > 0 ? k : h - k;
+			reverse_rows(s, top, top + m - 1);
+			reverse_rows(s, top + m, bot);
+			reverse_rows(s, top, bot);
+			s->frozen = MIN(s->frozen, top);
+		}
+	}
+	k = MIN(k, h);
+	clear_rows(s, n > 0 ? bot - k + 1 : top, n > 0 ? bot : top + k - 1);
+}
+
+/*
+ * Draw the extent.y x extent.x cells of s whose upper left corner is
+ * at off, into w at o.  Parts of the extent outside the grid are drawn
+ * as blanks, as is either half of a wide character that is split.
+ */
+void
+draw_screen(WINDOW *w, struct point o, struct screen *s, struct point off,
+	struct point extent)
+{
+	static cchar_t *buf;
+	static int siz;
+
+	if (extent.x + 1 > siz) {
+		cchar_t *t = realloc(buf, (extent.x + 1) * sizeof *t);
+		if (!check(t != NULL, ENOMEM, "draw buffer")) {
+			return;
+		}
+		buf = t;
+		siz = extent.x + 1;
+	}
+	for (int y = 0; y < extent.y; y++) {
+		int row = off.y + y, n = 0;
+		const struct cell *r = row >= -spilled_rows(s)
+			&& row < s->rows ? peek_row(s, row) : NULL;
+		for (int i = 0; i < extent.x; i++) {
+			int x = off.x + i;
+			struct cell c = r && x >= 0 && x < s->cols ? r[x] : blank;
+			if (c.c >= 0x80 && width(c.c) == 2) {
+				if (i + 1 < extent.x && x + 1 < s->cols
+						&& r[x + 1].c == 0) {
+					i += 1;
+				} else {
+					c.c = L' ';
+				}
+			} else if (c.c == 0) {
+				c.c = L' ';
+			}
+			wchar_t wc[2] = { c.c, L'\0' };
+			setcchar(buf + n++, wc, c.a, c.p, NULL);
+		}
+		mvwadd_wchnstr(w, o.y + y, o.x, buf, n);
+	}
+}
@@ -16,6 +16,11 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "smtx.h"
+#include "width.h"
+#if HAVE_PTHREAD
+# include <pthread.h>
+static pthread_mutex_t color_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
 
 void
 set_status(struct pty *p, const char *arg)
@@ -23,34 +28,263 @@ set_status(struct pty *p, const char *arg)
 	snprintf(p->status, sizeof p->status, "%s", arg);
 }
 
+/*
+ * Curses colors and the caches below are shared by every pty, so they
+ * are used by one thread at a time while ptys are parsed in parallel.
+ */
+static void
+lock_colors(bool lock)
+{
+#if HAVE_PTHREAD
+	if (S.parallel) {
+		(lock ? pthread_mutex_lock : pthread_mutex_unlock)(&color_lock);
+	}
+#else
+	(void)lock;
+#endif
+}
+
+#if HAVE_ALLOC_PAIR
+/*
+ * Color pairs are looked up in a small set associative cache before
+ * asking curses, which hashes every request.  When all pairs are in use,
+ * the ones not seen in any row that is not frozen are freed, so that
+ * curses does not recycle a pair that is still displayed.  Frozen and
+ * spilled rows keep colors instead, and look their pair up again when
+ * they are drawn (see grid.c).
+ */
+#define PAIR_SETS 64
+#define PAIR_WAYS 4
+static struct pair_slot {
+	int fg, bg;
+	short pair;
+	unsigned long used; /* 0 if the slot is empty */
+} pairs[PAIR_SETS][PAIR_WAYS];
+static unsigned long pair_clock;
+static int npairs; /* Pairs allocated since the last sweep */
+
+static void
+mark_pairs(unsigned char *seen, int n, struct screen *s)
+{
+	seen[s->c.p] = 1;
+	for (int y = 0; y < s->rows; y++) {
+		const struct cell *r = hot_row(s, y);
+		for (int x = 0; r && x < s->cols; x++) {
+			if (r[x].p > 0 && r[x].p < n) {
+				seen[r[x].p] = 1;
+			}
+		}
+	}
+}
+
+static int
+sweep_pairs(int n)
+{
+	int freed = 0;
+	unsigned char *seen = calloc(n, 1);
+	if (seen == NULL) {
+		return 0;
+	}
+	for (struct pty *p = S.p; p; p = p->next) {
+		mark_pairs(seen, n, p->scr);
+		mark_pairs(seen, n, p->scr + 1);
+	}
+	for (int i = 1; i < n; i++) {
+		freed += !seen[i] && free_pair(i) == OK;
+	}
+	for (int i = 0; i < PAIR_SETS * PAIR_WAYS; i++) {
+		struct pair_slot *e = pairs[i / PAIR_WAYS] + i % PAIR_WAYS;
+		if (e->used && !seen[e->pair]) {
+			e->used = 0;
+		}
+	}
+	free(seen);
+	return freed;
+}
+
+/*
+ * Free the pairs not in use once nearly all have been allocated.  A
+ * sweep reads every screen, so it is put off while ptys are parsed in
+ * parallel, and done when they are all parsed.
+ */
+void
+tidy_pairs(void)
+{
+	int limit = MIN(COLOR_PAIRS, SHRT_MAX + 1);
+	if (npairs >= limit - 1) {
+		/* If little was freed, let curses recycle for a while
+		rather than sweeping again on the next new pair */
+		npairs = limit - 1 - MAX(sweep_pairs(limit), limit / 4);
+	}
+}
+
+static short
+cached_pair(int fg, int bg)
+{
+	struct pair_slot *set = pairs[(unsigned)(fg * 31 + bg) % PAIR_SETS];
+	struct pair_slot *lru = set;
+	int p, limit = MIN(COLOR_PAIRS, SHRT_MAX + 1); /* c.p is a short */
+
+	for (int i = 0; i < PAIR_WAYS; i++) {
+		if (set[i].used && set[i].fg == fg && set[i].bg == bg) {
+			set[i].used = ++pair_clock;
+			return set[i].pair;
+		}
+		if (set[i].used < lru->used) {
+			lru = set + i;
+		}
+	}
+	if (find_pair(fg, bg) == -1 && ++npairs >= limit - 1
+			&& !S.parallel) {
+		tidy_pairs();
+	}
+	if ((p = alloc_pair(fg, bg)) == -1) {
+		return 0;
+	} else if (p >= limit) {
+		free_pair(p);
+		return 0;
+	}
+	*lru = (struct pair_slot){ fg, bg, p, ++pair_clock };
+	return p;
+}
+
+static short
+get_pair(int fg, int bg)
+{
+	lock_colors(true);
+	short p = cached_pair(fg, bg);
+	lock_colors(false);
+	return p;
+}
+#else
+void
+tidy_pairs(void)
+{
+}
+#endif
+
+void
+pair_colors(int pair, int *color)
+{
+	lock_colors(true);
+#if HAVE_ALLOC_PAIR
+	extended_pair_content(pair, color, color + 1);
+#else
+	short fg, bg;
+	pair_content(pair, &fg, &bg);
+	color[0] = fg;
+	color[1] = bg;
+#endif
+	lock_colors(false);
+}
+
+/* Return the pair for fg and bg, as SGR would select it */
+short
+color_pair(int fg, int bg)
+{
+#if HAVE_ALLOC_PAIR
+	return get_pair(fg, bg);
+#else
+	(void)fg;
+	(void)bg;
+	return 0;
+#endif
+}
+
+/* Find the entry of the palette nearest rgb */
+static int
+nearest_color(int rgb)
+{
+	static struct { int key, color; } cache[1024];
+	static const unsigned char base[16][3] = {
+		{0, 0, 0}, {205, 0, 0}, {0, 205, 0}, {205, 205, 0},
+		{0, 0, 238}, {205, 0, 205}, {0, 205, 205}, {229, 229, 229},
+		{127, 127, 127}, {255, 0, 0}, {0, 255, 0}, {255, 255, 0},
+		{92, 92, 255}, {255, 0, 255}, {0, 255, 255}, {255, 255, 255},
+	};
+	int r = rgb >> 16, g = rgb >> 8 & 0xff, b = rgb & 0xff;
+	typeof(*cache) *e = cache + (rgb * 2654435761u >> 22);
+	if (e->key == rgb + 1) {
+		return e->color;
+	}
+	/* The 16 base colors are often themed, so avoid them if possible */
+	int n = COLORS >= 256 ? 256 : COLORS >= 16 ? 16 : 8;
+	int best = INT_MAX;
+	for (int i = n == 256 ? 16 : 0; i < n; i++) {
+		int c[3];
+		for (int k = 0; k < 3; k++) {
+			if (i < 16) {
+				c[k] = base[i][k];
+			} else if (i < 232) {
+				int v = (i - 16) / (k == 0 ? 36 : k == 1 ? 6 : 1) % 6;
+				c[k] = v ? 55 + 40 * v : 0;
+			} else {
+				c[k] = 8 + 10 * (i - 232);
+			}
+		}
+		int d = 2 * (r - c[0]) * (r - c[0]) + 4 * (g - c[1]) * (g - c[1])
+			+ 3 * (b - c[2]) * (b - c[2]);
+		if (d < best) {
+			best = d;
+			e->color = i;
+		}
+	}
+	e->key = rgb + 1;
+	return e->color;
+}
+
+/*
+ * Map a direct color to the palette.  If the terminal has direct color
+ * it is passed through.  Otherwise the nearest entry of the xterm palette
+ * is found and remembered, so each distinct color is searched for once.
+ */
+static int
+rgb_color(int r, int g, int b)
+{
+	r = MAX(0, MIN(r, 255));
+	g = MAX(0, MIN(g, 255));
+	b = MAX(0, MIN(b, 255));
+	int rgb = r << 16 | g << 8 | b;
+	if (COLORS >= 0x1000000) {
+		return rgb;
+	}
+	lock_colors(true);
+	rgb = nearest_color(rgb);
+	lock_colors(false);
+	return rgb;
+}
+
+static void
+ring(const char *arg)
+{
+	(void)arg;
+	beep();
+}
+
 static void
 restore_cursor(struct screen *s)
 {
 	if (s->sc.gc) {
 		s->c = s->sc;
 		#if HAVE_ALLOC_PAIR
-		s->c.p = alloc_pair(s->c.color[0], s->c.color[1]);
+		s->c.p = get_pair(s->c.color[0], s->c.color[1]);
 		#endif
-		wattr_set(s->w, s->c.attr, s->c.p, NULL);
-		wbkgrndset(s->w, &s->c.bkg);
+		s->c.bkg.p = s->c.p;
 	}
 }
 
 static void
 save_cursor(struct screen *s)
 {
-	wattr_get(s->w, &s->c.attr, &s->c.p, NULL);
-	pair_content(s->c.p, s->sc.color, s->sc.color + 1);
 	s->sc = s->c;
 }
 
 static void
 reset_sgr(struct screen *s)
 {
-	pair_content(s->c.p = COLOR_PAIR(0), s->c.color, s->c.color + 1);
-	setcchar(&s->c.bkg, L" ", A_NORMAL, s->c.p, NULL);
-	wattr_set(s->w, A_NORMAL, s->c.p, NULL);
-	wbkgrndset(s->w, &s->c.bkg);
+	pair_colors(s->c.p = COLOR_PAIR(0), s->c.color);
+	s->c.attr = A_NORMAL;
+	s->c.bkg = (struct cell){ L' ', A_NORMAL, s->c.p };
 }
 
 static void
@@ -60,9 +294,84 @@ newline(struct screen *s, int cr)
 		s->c.xenl = s->c.x = 0;
 	}
 	if (s->c.y == s->scroll.bot) {
-		scroll(s->w);
+		scroll_screen(s, s->scroll.top, s->scroll.bot, 1);
 	} else {
-		wmove(s->w, ++s->c.y, s->c.x);
+		s->c.y += 1;
+	}
+	freeze_rows(s, false);
+}
+
+void
+set_tabs(struct pty *p, int tabstop)
+{
+	typeof(*p->tabs) *n;
+	if ((n = realloc(p->tabs, p->ws.ws_col * sizeof *n)) != NULL) {
+		memset(p->tabs = n, 0, p->ws.ws_col * sizeof *n);
+		for (int i = 0; i < p->ws.ws_col; i += tabstop) {
+			p->tabs[i] = true;
+		}
+	}
+}
+
+/* Display width of w, using the table generated by mkwidth */
+int
+width(wchar_t w)
+{
+	if (w >= 0x20 && w < 0x7f) {
+		return 1;
+	}
+#ifdef __STDC_ISO_10646__
+	if (w < 0 || w >= WIDTH_BLOCK * (wchar_t)sizeof width_index) {
+		return -1;
+	}
+	unsigned char b = width_table[width_index[w / WIDTH_BLOCK]]
+		[w % WIDTH_BLOCK / 4];
+	return (b >> (w % 4 * 2) & 3) - 1;
+#else
+	return wcwidth(w);
+#endif
+}
+
+/* Write n copies of c into row y starting at column x */
+static void
+fill_row(struct screen *s, int y, int x, int n, struct cell c)
+{
+	struct cell *r = get_row(s, y);
+	n = MIN(n, s->cols - x);
+	for (int i = 0; i < n; i++) {
+		r[x + i] = c;
+	}
+}
+
+/*
+ * Move the cells of row y from column x to the end of the line n
+ * columns right (or left, if n is negative) with a single copy, and
+ * fill the columns left vacant with c.  Cells moved past the end of
+ * the line are lost.
+ */
+static void
+shift_row(struct screen *s, int y, int x, int n, struct cell c)
+{
+	struct cell *r = get_row(s, y);
+	int k = MIN(abs(n), s->cols - x);
+	if (k <= 0) {
+		return;
+	}
+	memmove(r + (n > 0 ? x + k : x), r + (n > 0 ? x : x + k),
+		(s->cols - x - k) * sizeof *r);
+	fill_row(s, y, n > 0 ? x : s->cols - k, k, c);
+}
+
+/* Write w, which is n columns wide, at the cursor */
+static void
+put_char(struct screen *s, wchar_t w, int n)
+{
+	struct cell *r = get_row(s, s->c.y) + s->c.x;
+	if (s->c.x + n <= s->cols) {
+		r[0] = (struct cell){ w, s->c.attr, s->c.p };
+		if (n == 2) {
+			r[1] = (struct cell){ 0, s->c.attr, s->c.p };
+		}
 	}
 }
 
@@ -70,7 +379,7 @@ static void
 print_char(wchar_t w, struct pty *p)
 {
 	if (p->s->insert) {
-		wins_wch(p->s->w, &p->s->c.bkg);
+		shift_row(p->s, p->s->c.y, p->s->c.x, 1, p->s->c.bkg);
 	}
 	if (p->s->c.xenl && p->s->decawm) {
 		newline(p->s, 1);
@@ -78,17 +387,65 @@ print_char(wchar_t w, struct pty *p)
 	if (w < 0x7f && p->s->c.gc[w]) {
 		w = p->s->c.gc[w];
 	}
-	if (p->s->c.x >= p->ws.ws_col - wcwidth(w)) {
+	int n = width(w);
+	put_char(p->s, w, n);
+	if (p->s->c.x >= p->ws.ws_col - n) {
 		p->s->c.xenl = 1;
-		wins_nwstr(p->s->w, &w, 1);
 	} else {
 		p->s->c.xenl = 0;
-		waddnwstr(p->s->w, &w, 1);
-		p->s->c.x += wcwidth(w);
+		p->s->c.x += n;
 	}
 	p->s->c.gc = p->s->c.gs;
 }
 
+/*
+ * Print a run of printable ASCII.  This is equivalent to calling
+ * tput(p, w, 0, 0, NULL, print) for each byte of the run, but writes
+ * as much of the run as fits on the current line at once.
+ */
+void
+tprint(struct pty *p, const char *s, size_t n)
+{
+	struct screen *scr = p->s;
+	const int col = p->ws.ws_col;
+
+	if (scr->insert || scr->c.gc != CSET_US || scr->c.gs != CSET_US
+			|| scr->c.y > scr->scroll.bot) {
+		while (n--) {
+			tput(p, *s++, 0, 0, NULL, print);
+		}
+		return;
+	}
+	scr->repc = s[n - 1];
+	while (n > 0) {
+		if (scr->c.xenl && scr->decawm) {
+			newline(scr, 1);
+		}
+		struct cell *r = get_row(scr, scr->c.y) + scr->c.x;
+		if (scr->c.x < col - 1) {
+			int k = MIN(n, (size_t)(col - 1 - scr->c.x));
+			for (int i = 0; i < k; i++) {
+				r[i] = (struct cell){ s[i], scr->c.attr, scr->c.p };
+			}
+			scr->c.xenl = 0;
+			scr->c.x += k;
+			s += k;
+			n -= k;
+		} else {
+			if (!scr->decawm) {
+				/* Each character overwrites the last column */
+				s += n - 1;
+				n = 1;
+			}
+			scr->c.xenl = 1;
+			*r = (struct cell){ *s++, scr->c.attr, scr->c.p };
+			n -= 1;
+		}
+	}
+	scr->maxy = MAX(scr->c.y, scr->maxy);
+	p->tos = MAX(0, scr->maxy - p->ws.ws_row + 1);
+}
+
 static short colors[] = {
 	COLOR_BLACK,
 	COLOR_RED,
@@ -122,7 +479,6 @@ tput(struct pty *p, wchar_t w, wchar_t iw, int argc, int *argv, int handler)
 	/* First arg, defaulting to 0 or 1 */
 	int p0[] = { argc ? *argv : 0, argc ? *argv : 1 };
 	struct screen *s = p->s; /* the current SCRN buffer */
-	WINDOW *win = s->w;      /* the current window */
 
 	const int tos = p->tos;
 	const int y = s->c.y - tos; /* cursor position w.r.t. top of screen */
@@ -132,10 +488,10 @@ tput(struct pty *p, wchar_t w, wchar_t iw, int argc, int *argv, int handler)
 
 	switch ((enum cmd)handler) {
 	case ack:
-		rewrite(p->fd, "\006", 1);
+		write_pty(p, "\006", 1);
 		break;
 	case bell:
-		beep();
+		run_later(p, ring, "");
 		break;
 	case cr:
 		s->c.x = 0;
@@ -163,40 +519,34 @@ tput(struct pty *p, wchar_t w, wchar_t iw, int argc, int *argv, int handler)
 		s->c.y -= p0[1];
 		break;
 	case dch:
-		for (i = 0; i < p0[1]; i++) {
-			wdelch(win);
-		}
+		shift_row(s, s->c.y, s->c.x, -p0[1], s->c.bkg);
 		break;
 	case ech:
-		for (i = 0; i < p0[1]; i++) {
-			mvwadd_wch(win, s->c.y, s->c.x + i, &s->c.bkg);
-		}
+		fill_row(s, s->c.y, s->c.x, p0[1], s->c.bkg);
 		break;
 	case ed: /* Fallthru */
 	case el:
 		switch (p0[0]) {
-		case 2:
-			wmove(win, handler == el ? s->c.y : tos, 0);
-			/* Fall Thru */
 		case 0:
-			(handler == el ? wclrtoeol : wclrtobot)(win);
+		case 2:
+			i = p0[0] == 0 || handler == el ? s->c.y : tos;
+			t1 = p0[0] == 0 ? s->c.x : 0;
+			fill_row(s, i, t1, s->cols - t1, s->c.bkg);
+			if (handler == ed) {
+				clear_rows(s, i + 1, s->rows - 1);
+			}
 			break;
 		case 3:
 			if (handler == ed) {
-				werase(win);
+				clear_rows(s, 0, s->rows - 1);
+				drop_spill(s);
 			}
 			break;
 		case 1:
 			if (handler == ed) {
-				for (i = tos; i < s->c.y; i++) {
-					wmove(win, i, 0);
-					wclrtoeol(win);
-				}
-				wmove(win, s->c.y, s->c.x);
-			}
-			for (i = 0; i <= s->c.x; i++) {
-				mvwadd_wch(win, s->c.y, i, &s->c.bkg);
+				clear_rows(s, tos, s->c.y - 1);
 			}
+			fill_row(s, s->c.y, 0, s->c.x + 1, s->c.bkg);
 		}
 		break;
 	case hpa:
@@ -209,9 +559,7 @@ tput(struct pty *p, wchar_t w, wchar_t iw, int argc, int *argv, int handler)
 		p->tabs[s->c.x] = true;
 		break;
 	case ich:
-		for (i = 0; i < p0[1]; i++) {
-			wins_wch(win, &p->s->c.bkg);
-		}
+		shift_row(s, s->c.y, s->c.x, p0[1], s->c.bkg);
 		break;
 	case idl:
 		/* We don't use insdelln here because it inserts above and
@@ -221,9 +569,7 @@ tput(struct pty *p, wchar_t w, wchar_t iw, int argc, int *argv, int handler)
 		assert( y == s->c.y - tos);
 		assert( tos == 0 || p->ws.ws_row - 1 - y == s->maxy - s->c.y );
 
-		wsetscrreg(win, s->c.y, s->scroll.bot);
-		wscrl(win, w == L'L' ? -i : i);
-		wsetscrreg(win, s->scroll.top, s->scroll.bot);
+		scroll_screen(s, s->c.y, s->scroll.bot, w == L'L' ? -i : i);
 		s->c.x = 0;
 		break;
 	case numkp:
@@ -233,20 +579,16 @@ tput(struct pty *p, wchar_t w, wchar_t iw, int argc, int *argv, int handler)
 		assert( 0 );
 		break;
 	case rc:
-		if (iw == L'#' ) for (int r = 0; r < p->ws.ws_row; r++) {
-			cchar_t e;
-			setcchar(&e, L"E", A_NORMAL, COLOR_PAIR(0), NULL);
-			for (int c = 0; c < p->ws.ws_col; c++) {
-				mvwadd_wch(p->s->w, tos + r, c, &e);
-			}
+		if (iw == L'#' ) for (int r = tos; r < tos + p->ws.ws_row
+				&& r < s->rows; r++) {
+			struct cell e = { L'E', A_NORMAL, COLOR_PAIR(0) };
+			fill_row(s, r, 0, p->ws.ws_col, e);
 		}
 		restore_cursor(s);
 		break;
 	case ri:
 		if (y == top) {
-			wsetscrreg(win, MAX(s->scroll.top, tos), s->scroll.bot);
-			wscrl(win, -1);
-			wsetscrreg(win, s->scroll.top, s->scroll.bot);
+			scroll_screen(s, MAX(s->scroll.top, tos), s->scroll.bot, -1);
 		} else {
 			s->c.y = MAX(tos, s->c.y - 1);
 		}
@@ -255,7 +597,8 @@ tput(struct pty *p, wchar_t w, wchar_t iw, int argc, int *argv, int handler)
 		save_cursor(s);
 		break;
 	case su:
-		wscrl(win, (w == L'T' || w == L'^') ? -p0[1] : p0[1]);
+		scroll_screen(s, s->scroll.top, s->scroll.bot,
+			(w == L'T' || w == L'^') ? -p0[1] : p0[1]);
 		break;
 	case tab:
 		for (i = 0; i < p0[1]; i += p->tabs[s->c.x] ? 1 : 0) {
@@ -282,9 +625,11 @@ tput(struct pty *p, wchar_t w, wchar_t iw, int argc, int *argv, int handler)
 		break;
 	case ris:
 		ioctl(p->fd, TIOCGWINSZ, &p->ws);
+		/* The child may have widened the pty beyond the screen */
+		p->ws.ws_col = MIN(p->ws.ws_col, s->cols);
 		p->g[0] = p->g[2] = CSET_US;
 		p->g[1] = p->g[3] = CSET_GRAPH;
-		p->decom = s->insert = p->lnm = false;
+		p->decom = s->insert = p->lnm = p->bpaste = p->sync = false;
 		reset_sgr(s);
 		s->decawm = p->pnm = true;
 		for (i = 0, s = p->s = p->scr; i < 2; i++, s++) {
@@ -293,7 +638,6 @@ tput(struct pty *p, wchar_t w, wchar_t iw, int argc, int *argv, int handler)
 			set_scroll(s, 0, s->rows - 1);
 		}
 		set_tabs(p, p->tabstop);
-		vtreset(&p->vp);
 		break;
 	case mode:
 		for (i = 0; i < argc; i++) {
@@ -303,7 +647,7 @@ tput(struct pty *p, wchar_t w, wchar_t iw, int argc, int *argv, int handler)
 				p->pnm = set;
 				break;
 			case  3:
-				set_width(set ? "132" : "80");
+				run_later(p, set_width, set ? "132" : "80");
 				break;
 			case  4:
 				s->insert = set;
@@ -328,6 +672,14 @@ tput(struct pty *p, wchar_t w, wchar_t iw, int argc, int *argv, int handler)
 			case 1048:
 				(set ? save_cursor : restore_cursor)(s);
 				break;
+			case 2004:
+				p->bpaste = set;
+				break;
+			case 2026:
+				if ((p->sync = set)) {
+					clock_gettime(CLOCK_MONOTONIC, &p->synced);
+				}
+				break;
 			case 1049:
 				(set ? save_cursor : restore_cursor)(s);
 				/* fall thru */
@@ -337,8 +689,8 @@ tput(struct pty *p, wchar_t w, wchar_t iw, int argc, int *argv, int handler)
 				if (set && p->s == p->scr) {
 					struct screen *alt = p->scr + 1;
 					alt->c.x = alt->c.xenl = 0;
-					alt->c.y = dtop;
-					wclear(alt->w);
+					alt->c.y = dtop - tos;
+					clear_rows(alt, 0, alt->rows - 1);
 				}
 				p->s = p->scr + !!set;
 			}
@@ -347,7 +699,9 @@ tput(struct pty *p, wchar_t w, wchar_t iw, int argc, int *argv, int handler)
 	case sgr:
 	{
 		bool doc = false;
-		if (!argc) {
+		if (iw) {
+			break; /* Not an SGR, eg xterm's key modifiers (CSI > m) */
+		} else if (!argc) {
 			reset_sgr(s);
 		} else for (i = 0; i < argc; i++) {
 			int k = 1, a;
@@ -362,7 +716,7 @@ tput(struct pty *p, wchar_t w, wchar_t iw, int argc, int *argv, int handler)
 			case  5:
 			case  7:
 			case  8:
-				wattron(win, attrs[a]);
+				s->c.attr |= attrs[a];
 				break;
 			case 21:
 			case 22:
@@ -370,7 +724,7 @@ tput(struct pty *p, wchar_t w, wchar_t iw, int argc, int *argv, int handler)
 			case 24:
 			case 25:
 			case 27:
-				wattroff(win, attrs[a - 20]);
+				s->c.attr &= ~attrs[a - 20];
 				break;
 			case 30:
 			case 31:
@@ -394,6 +748,13 @@ tput(struct pty *p, wchar_t w, wchar_t iw, int argc, int *argv, int handler)
 				break;
 			case 38:
 			case 48:
+				if (argc > i + 4 && argv[i + 1] == 2) {
+					s->c.color[a == 48] = rgb_color(argv[i + 2],
+						argv[i + 3], argv[i + 4]);
+					i += 4;
+					doc = COLORS >= 8;
+					break;
+				}
 				if (argc > i + 2 && argv[i + 1] == 5){
 					s->c.color[a == 48] = argv[i + 2];
 				}
@@ -428,11 +789,9 @@ tput(struct pty *p, wchar_t w, wchar_t iw, int argc, int *argv, int handler)
 		}
 		if (doc) {
 			#if HAVE_ALLOC_PAIR
-			s->c.p = alloc_pair(s->c.color[0], s->c.color[1]);
+			s->c.p = get_pair(s->c.color[0], s->c.color[1]);
 			#endif
-			wcolor_set(win, s->c.p, NULL);
-			setcchar(&s->c.bkg, L" ", A_NORMAL, s->c.p, NULL);
-			wbkgrndset(win, &s->c.bkg);
+			s->c.bkg.p = s->c.p;
 		}
 	}
 		break;
@@ -453,12 +812,14 @@ tput(struct pty *p, wchar_t w, wchar_t iw, int argc, int *argv, int handler)
 		s->repc = w;
 		/* Fallthru */
 	case rep:
-		if (wcwidth(w = s->repc) > 0) {
+		if (width(w = s->repc) > 0) {
 			for (i = 0; i < p0[1]; i++) {
 				print_char(w, p);
 			}
 		}
 		break;
+	case prun: /* The text is not available here; see tprint */
+		break;
 	case scs:
 		for (const char *s = "()*+", *c = strchr(s, iw); c; c = NULL )
 		switch (w) {
@@ -512,7 +873,6 @@ tput(struct pty *p, wchar_t w, wchar_t iw, int argc, int *argv, int handler)
 	p->s->c.y = MAX(0, MIN(p->s->c.y, tos + bot - 1));
 	p->s->maxy = MAX(p->s->c.y, p->s->maxy);
 	p->tos = MAX(0, p->s->maxy - p->ws.ws_row + 1);
-	wmove(p->s->w, p->s->c.y, p->s->c.x);
 }
 
 #define CONTROL \
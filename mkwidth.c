@@ -0,0 +1,92 @@
+/*
+ * Copyright 2020 - 2023 William Pursell <william.r.pursell@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Write width.h, a two level table of the display width of every
+ * Unicode code point as reported by the C library in a UTF-8 locale.
+ * The code points are split into blocks of 256, and identical blocks
+ * are stored once.  Each width w is stored as w + 1 in two bits, so
+ * the non-printable value -1 is 0.
+ */
+#include <err.h>
+#include <langinfo.h>
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#define NCODE 0x110000
+#define BLOCK 256
+#define NBLOCK (NCODE / BLOCK)
+
+static unsigned char blocks[NBLOCK][BLOCK / 4];
+static int blockof[NBLOCK];
+
+int
+main(void)
+{
+	const char *locales[] = { "C.UTF-8", "en_US.UTF-8", "C.utf8", "", NULL };
+	const char **l = locales;
+	int n = 0;
+
+	while (*l && !(setlocale(LC_CTYPE, *l)
+			&& !strcmp(nl_langinfo(CODESET), "UTF-8"))) {
+		l += 1;
+	}
+	if (*l == NULL) {
+		errx(EXIT_FAILURE, "no UTF-8 locale is available");
+	}
+	for (int b = 0; b < NBLOCK; b++) {
+		unsigned char *t = blocks[n];
+		memset(t, 0, BLOCK / 4);
+		for (int i = 0; i < BLOCK; i++) {
+			int w = wcwidth(b * BLOCK + i);
+			w = w < 0 ? -1 : w > 2 ? 2 : w;
+			t[i / 4] |= (w + 1) << (i % 4 * 2);
+		}
+		blockof[b] = n;
+		for (int k = 0; k < n; k++) {
+			if (!memcmp(blocks[k], t, BLOCK / 4)) {
+				blockof[b] = k;
+				break;
+			}
+		}
+		n += blockof[b] == n;
+	}
+	if (n > 256) {
+		errx(EXIT_FAILURE, "%d distinct blocks do not fit an index", n);
+	}
+	printf("/* Generated by mkwidth.  Do not edit. */\n");
+	printf("#define WIDTH_BLOCK %d\n", BLOCK);
+	printf("static const unsigned char width_index[%d] = {", NBLOCK);
+	for (int b = 0; b < NBLOCK; b++) {
+		printf("%s%d,", b % 16 ? " " : "\n\t", blockof[b]);
+	}
+	printf("\n};\n");
+	printf("static const unsigned char width_table[%d][%d] = {",
+		n, BLOCK / 4);
+	for (int k = 0; k < n; k++) {
+		printf("\n\t{");
+		for (int i = 0; i < BLOCK / 4; i++) {
+			printf("%s0x%02x,", i % 8 ? " " : "\n\t\t", blocks[k][i]);
+		}
+		printf("\n\t},");
+	}
+	printf("\n};\n");
+	return ferror(stdout) || fclose(stdout) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -25,7 +25,10 @@ struct state S = {
 	.binding = k1,
 	.history = 1024,
 	.count = -1,
+	.fps = 60,
 };
+static sigset_t signals;  /* Delivered through the event loop */
+static int sigfd = -1;
 
 static const char *
 getshell(void)
@@ -35,18 +38,6 @@ getshell(void)
 	return s ? s : pwd ? pwd->pw_shell : "/bin/sh";
 }
 
-void
-set_tabs(struct pty *p, int tabstop)
-{
-	typeof(*p->tabs) *n;
-	if ((n = realloc(p->tabs, p->ws.ws_col * sizeof *n)) != NULL) {
-		memset(p->tabs = n, 0, p->ws.ws_col * sizeof *n);
-		for (int i = 0; i < p->ws.ws_col; i += tabstop) {
-			p->tabs[i] = true;
-		}
-	}
-}
-
 int
 resize_pad(WINDOW **p, int h, int w)
 {
@@ -77,17 +68,23 @@ new_pty(int rows, int cols, bool new)
 	struct pty *p = get_freepty(!new);
 	if (check(p != NULL, errno = 0, "calloc")) {
 		if (p->s == NULL) {
-			if (resize_pad(&p->scr[0].w, rows, cols)
-				&& resize_pad(&p->scr[1].w, rows, cols)
+			/* The alternate screen has no history */
+			int alt = MAX(1, LINES - 1);
+			if (resize_screen(&p->scr[0], rows, cols)
+				&& resize_screen(&p->scr[1], alt, cols)
 			){
-				p->scr[0].rows = p->scr[1].rows = rows;
 				*(S.tail ? &S.tail->next : &S.p) = p;
 				S.tail = p;
 				set_scroll(p->scr, 0, rows - 1);
-				set_scroll(&p->scr[1], 0, rows - 1);
+				set_scroll(&p->scr[1], 0, alt - 1);
+				p->scr[1].maxy = alt - 1;
+				if (S.spill) {
+					spill_screen(p->scr, S.spill);
+				}
 			} else {
-				delwin(p->scr[0].w);
-				delwin(p->scr[1].w);
+				for (int i = 0; i < 2; i++) {
+					free_screen(p->scr + i);
+				}
 				free(p);
 				return NULL;
 			}
@@ -95,19 +92,29 @@ new_pty(int rows, int cols, bool new)
 		if (p->fd < 1) {
 			const char *sh = getshell();
 			p->ws.ws_row = LINES - 1;
-			p->ws.ws_col = cols;
+			/* A pty being reused keeps its screens */
+			for (int i = 0; i < 2; i++) {
+				if (p->scr[i].cols != cols) {
+					resize_screen(p->scr + i, p->scr[i].rows,
+						cols);
+				}
+			}
+			p->ws.ws_col = MIN(p->scr[0].cols, p->scr[1].cols);
 			p->tos = rows - p->ws.ws_row;
+			/* Forget the last child of a reused pty */
+			p->reaped = false;
+			memset(p->status, 0, sizeof p->status);
 			p->pid = forkpty(&p->fd, p->secondary, NULL, &p->ws);
 			if (check(p->pid != -1, 0, "forkpty") && p->pid == 0) {
 				setsid();
+				sigprocmask(SIG_UNBLOCK, &signals, NULL);
 				signal(SIGCHLD, SIG_DFL);
 				setenv("TERM", S.term, 1);
 				execl(sh, sh, NULL);
 				err(EXIT_FAILURE, "exec SHELL='%s'", sh);
 			}
 			set_tabs(p, p->tabstop = 8);
-			FD_SET(p->fd, &S.fds);
-			S.maxfd = p->fd > S.maxfd ? p->fd : S.maxfd;
+			ev_set(p->fd, EV_READ | EV_DATA, p);
 			fcntl(p->fd, F_SETFL, O_NONBLOCK);
 			const char *bname = strrchr(sh, '/');
 			bname = bname ? bname + 1 : sh;
@@ -117,6 +124,7 @@ new_pty(int rows, int cols, bool new)
 			p->s = &p->scr[0];
 			tput(p, 0, 0, 0, NULL, ris);
 			p->vp.p = p;
+			vtreset(&p->vp);
 		}
 	}
 	return p;
@@ -144,22 +152,35 @@ newcanvas(struct pty *p, struct canvas *parent)
 	return n;
 }
 
+/*
+ * Draw the visible part of the screen of the pty in n into S.wpty,
+ * leaving the cursor of S.wpty at the cursor of the pty if it is
+ * visible, and copy that part of S.wpty to the virtual screen.
+ */
 static void
 draw_window(struct canvas *n)
 {
 	struct point o = n->origin;
 	struct point e = { o.y + n->extent.y - 1, o.x + n->extent.x - 1 };
-	if (n->p && e.y > 0 && e.x > 0) {
+	if (n->p && !n->p->sync && e.y > 0 && e.x > 0) {
+		struct screen *s = n->p->s;
 		if (! n->manualscroll) {
-			n->offset.x = MAX(0, n->p->s->c.x - n->extent.x + 1);
+			n->offset.x = MAX(0, s->c.x - n->extent.x + 1);
 		}
 		struct point off = n->offset;
+		struct point ext = n->extent;
 		if (n->p->ws.ws_col < n->extent.x) {
 			assert( n->offset.x == 0 );
 			pnoutrefresh(S.wbkg, 0, 0, o.y, o.x + n->p->ws.ws_col,
 				e.y, e.x);
+			ext.x = n->p->ws.ws_col;
+		}
+		draw_screen(S.wpty, o, s, off, ext);
+		int y = o.y + s->c.y - off.y, x = o.x + s->c.x - off.x;
+		if (y >= o.y && y <= e.y && x >= o.x && x < o.x + ext.x) {
+			wmove(S.wpty, y, x);
 		}
-		pnoutrefresh(n->p->s->w, off.y, off.x, o.y, o.x, e.y, e.x);
+		pnoutrefresh(S.wpty, o.y, o.x, o.y, o.x, e.y, o.x + ext.x - 1);
 	}
 }
 
@@ -177,16 +198,18 @@ fixcursor(void) /* Move the terminal cursor to the active window. */
 void
 reshape_window(struct pty *p)
 {
+	struct screen *alt = p->scr + 1;
+	int d = p->ws.ws_row - alt->rows;
+	/* The alternate screen is only as tall as the pty */
+	if (p->ws.ws_row > 0 && d && resize_screen(alt, p->ws.ws_row,
+			alt->cols)) {
+		alt->c.y = MAX(0, alt->c.y + d);
+		alt->maxy = alt->rows - 1;
+	}
 	check(ioctl(p->fd, TIOCSWINSZ, &p->ws) == 0, 0, "ioctl on %d", p->fd);
 	check(kill(p->pid, SIGWINCH) == 0, 0, "send WINCH to %d", (int)p->pid);
 	set_scroll(p->scr, 0, p->scr->rows - 1);
-	set_scroll(p->scr + 1, p->tos, p->scr->rows - 1);
-}
-
-void
-set_scroll(struct screen *s, int top, int bottom)
-{
-	wsetscrreg(s->w, s->scroll.top = top, s->scroll.bot = bottom);
+	set_scroll(alt, 0, alt->rows - 1);
 }
 
 
@@ -224,9 +247,8 @@ reshape(struct canvas *n, int y, int x, int h, int w)
 		set ws.ws_row to the one with biggest extent.y */
 		if (n->p->fd >= 0 && n->extent.y > n->p->ws.ws_row) {
 			n->p->ws.ws_row = n->extent.y;
-			n->p->tos = n->p->scr->rows - n->extent.y;
 			reshape_window(n->p);
-			wrefresh(n->p->s->w);
+			n->p->tos = n->p->s->rows - n->extent.y;
 		}
 		scrollbottom(n);
 	}
@@ -270,7 +292,7 @@ draw_pane(WINDOW *w, int y, int x)
 	pnoutrefresh(w, 0, 0, y, x, y + wy - 1, x + wx - 1);
 }
 
-static void
+void
 draw_title(struct canvas *n, int r)
 {
 	assert( n->wtit );
@@ -313,69 +335,494 @@ draw(struct canvas *n) /* Draw a canvas. */
 }
 
 static void
-wait_child(struct pty *p)
+set_exit_status(struct pty *p, int status)
 {
-	int status, k = 0;
+	int k = 0;
 	const char *fmt = "exited %d";
-	if (check(waitpid(p->pid, &status, WNOHANG) != -1, 0, "waitpid")) {
-		if (WIFEXITED(status)) {
-			k = WEXITSTATUS(status);
-		} else if (WIFSIGNALED(status)) {
-			fmt = "caught signal %d";
-			k = WTERMSIG(status);
-		}
-		FD_CLR(p->fd, &S.fds);
-		check(close(p->fd) == 0, 0, "close fd %d", p->fd);
-		snprintf(p->status, sizeof p->status, fmt, k);
-		p->fd = -1; /* (1) */
-		S.reshape = 1;
+	if (WIFEXITED(status)) {
+		k = WEXITSTATUS(status);
+	} else if (WIFSIGNALED(status)) {
+		fmt = "caught signal %d";
+		k = WTERMSIG(status);
+	}
+	snprintf(p->status, sizeof p->status, fmt, k);
+	p->reaped = true;
+	S.redraw = MAX(S.redraw, 1);
+}
+
+/* Reap all children that have exited, as soon as SIGCHLD arrives. */
+static void
+reap_children(void)
+{
+	int status;
+	pid_t pid;
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		for (struct pty *p = S.p; p; p = p->next) {
+			if (p->pid == pid && !p->reaped) {
+				set_exit_status(p, status);
+				break;
+			}
+		}
 	}
 }
+
+/* Close a pty whose child has exited or closed its side of the pty. */
+static void
+wait_child(struct pty *p)
+{
+	int status;
+	if (!p->reaped && waitpid(p->pid, &status, WNOHANG) == p->pid) {
+		set_exit_status(p, status);
+	}
+	ev_set(p->fd, 0, NULL);
+	p->wq.off = p->wq.len = 0;
+	check(close(p->fd) == 0, 0, "close fd %d", p->fd);
+	p->fd = -1; /* (1) */
+	S.reshape = 1;
+}
 /* (1) We do not free(p) because we wish to retain error messages.
  * The windows will persist until the user explicitly destroys them.
  */
 
+/*
+ * Keys bound to send are collected and written to the focused pty
+ * together, so that a burst of typing or a paste costs one write
+ * rather than one per key.  Between bracketed paste markers no
+ * bindings are consulted, so a pasted control key is sent verbatim.
+ * The markers themselves are forwarded only if the pty has enabled
+ * bracketed paste.
+ */
+#define KEY_PASTE_BEGIN (KEY_MAX + 1)
+#define KEY_PASTE_END   (KEY_MAX + 2)
+static struct buf keybuf;
+
 static void
-getinput(void) /* check stdin and all pty's for input. */
+flush_keys(void)
 {
-	fd_set sfds = S.fds;
-	if (select(S.maxfd + 1, &sfds, NULL, NULL, NULL) < 0) {
-		check(errno == EINTR, 0, "select");
-		return;
+	if (keybuf.len && S.f) {
+		write_pty(S.f->p, keybuf.b, keybuf.len);
+		scrollbottom(S.f);
 	}
-	if (FD_ISSET(STDIN_FILENO, &sfds)) {
-		int r;
-		wint_t w;
-		while (S.f && (r = wget_wch(S.f->p->s->w, &w)) != ERR) {
-			struct handler *b = NULL;
-			if (r == OK && w > 0 && w < 128) {
-				b = S.binding + w;
-			} else if (r == KEY_CODE_YES) {
-				assert( w >= KEY_MIN && w <= KEY_MAX );
-				b = &code_keys[w - KEY_MIN];
+	keybuf.len = 0;
+}
+
+static void
+getkeys(void)
+{
+	static bool paste;
+	int r;
+	wint_t w;
+	while (S.f && (r = wget_wch(S.wkey, &w)) != ERR) {
+		struct handler *b = NULL;
+		char mb[MB_LEN_MAX];
+		size_t n;
+		if (r == KEY_CODE_YES && w > KEY_MAX) {
+			paste = w == KEY_PASTE_BEGIN;
+			if (S.f->p->bpaste) {
+				buf_append(&keybuf, paste ? "\033[200~"
+					: "\033[201~", 6);
 			}
-			if (b) {
-				b->arg ? b->act.a(b->arg) : b->act.v();
-				if (b->act.a != digit) {
-					S.count = -1;
-				}
+			continue;
+		}
+		if (r == OK && w > 0 && w < 128) {
+			b = paste ? NULL : S.binding + w;
+		} else if (r == KEY_CODE_YES) {
+			assert( w >= KEY_MIN && w <= KEY_MAX );
+			b = &code_keys[w - KEY_MIN];
+		}
+		if (paste && r == OK) {
+			if ((n = wcrtomb(mb, w, NULL)) != (size_t)-1) {
+				buf_append(&keybuf, mb, n);
 			}
+		} else if (b && b->act.a == send) {
+			buf_append(&keybuf, b->arg + 1, b->arg[0]);
+		} else if (b && b->act.v == send_cr) {
+			buf_append(&keybuf, "\r\n", S.f->p->lnm ? 2 : 1);
+		} else if (b && !paste) {
+			flush_keys();
+			b->arg ? b->act.a(b->arg) : b->act.v();
+		}
+		if (b && b->act.a != digit) {
+			S.count = -1;
+		}
+	}
+	flush_keys();
+}
+
+/*
+ * Writes to a pty never block.  Whatever the pty does not accept
+ * immediately is queued (up to WQ_MAX bytes) and written as the fd
+ * becomes writable.
+ */
+#define WQ_MAX (1024 * 1024)
+static void
+set_events(struct pty *p)
+{
+	ev_set(p->fd, (p->throttled ? 0 : EV_READ | EV_DATA)
+		| (p->wq.len > p->wq.off ? EV_WRITE : 0), p);
+}
+
+static size_t
+try_write(struct pty *p, const char *b, size_t n)
+{
+	const char *s = b;
+	ssize_t r = 0;
+	while (s < b + n && ((r = write(p->fd, s, b + n - s)) > 0
+			|| (r == -1 && errno == EINTR))) {
+		s += r > 0 ? r : 0;
+	}
+	check(r != -1 || errno == EAGAIN || errno == EWOULDBLOCK, 0,
+		"write to pty %d", p->fd - 2);
+	return s - b;
+}
+
+void
+write_pty(struct pty *p, const char *b, size_t n)
+{
+	size_t w, q;
+	if (!check(p->fd > 0, errno = 0, "pty has exited")) {
+		return;
+	}
+	w = p->wq.len > p->wq.off ? 0 : try_write(p, b, n);
+	q = p->wq.len - p->wq.off;
+	if (w < n && check(q + n - w <= WQ_MAX, errno = 0,
+			"write queue full on pty %d", p->fd - 2)
+			&& buf_append(&p->wq, b + w, n - w) && !S.parallel) {
+		set_events(p); /* Or when the batch is done (see finish_read) */
+	}
+}
+
+static void
+drain_wq(struct pty *p)
+{
+	struct buf *q = &p->wq;
+	q->off += try_write(p, q->b + q->off, q->len - q->off);
+	if (q->off == q->len) {
+		q->off = q->len = 0;
+		set_events(p);
+	}
+}
+
+/*
+ * Output from a pty that is not attached to any canvas is not parsed
+ * as it arrives, but is saved and parsed in bulk when the pty becomes
+ * visible or HIDDEN_MAX bytes accumulate.  Nothing is drawn for such a
+ * pty either way, so this only saves the cost of a parse per read.
+ * Output that requires a timely response (ENQ) or may change the
+ * layout (OSC) is never deferred.
+ */
+#define HIDDEN_MAX (256 * 1024)
+static int
+has_osc(const struct pty *t, const char *b, size_t n)
+{
+	const char *e = b + n;
+	char prev = t->hidden.len ? t->hidden.b[t->hidden.len - 1] : 0;
+	for (const char *c = b; (c = memchr(c, ']', e - c)) != NULL; c++) {
+		if ((c > b ? c[-1] : prev) == '\033') {
+			return 1;
 		}
 	}
+	return 0;
+}
+
+static int
+defer(struct pty *t, const char *b, size_t n)
+{
+	return t->hidden.len + n <= HIDDEN_MAX
+		&& memchr(b, '\005', n) == NULL
+		&& !has_osc(t, b, n)
+		&& buf_append(&t->hidden, b, n);
+}
+
+/* Parse the deferred output, and drop the buffer once t is visible */
+static void
+flush_hidden(struct pty *t)
+{
+	if (t->hidden.len) {
+		vtwrite(&t->vp, t->hidden.b, t->hidden.len);
+		t->hidden.len = 0;
+	}
+	if (t->count && t->hidden.b) {
+		free(t->hidden.b);
+		t->hidden = (struct buf){ 0 };
+	}
+}
+
+/* Parse deferred output of any pty that has become visible. */
+static void
+flush_visible(void)
+{
 	for (struct pty *t = S.p; t; t = t->next) {
-		if (t->fd > 0 && FD_ISSET(t->fd, &sfds)) {
-			FD_CLR(t->fd, &sfds);
-			char iobuf[BUFSIZ];
+		if (t->count && t->hidden.len) {
 			int oldmax = t->s->maxy;
-			ssize_t r = read(t->fd, iobuf, sizeof iobuf);
-			if (r > 0) {
-				vtwrite(&t->vp, iobuf, r);
-				t->s->delta = t->s->maxy - oldmax;
-			} else if (errno != EINTR && errno != EWOULDBLOCK) {
-				wait_child(t);
+			flush_hidden(t);
+			t->s->delta = t->s->maxy - oldmax;
+			S.redraw = MAX(S.redraw, 1);
+		}
+	}
+}
+
+static long
+elapsed_ms(const struct timespec *t)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - t->tv_sec) * 1000
+		+ (now.tv_nsec - t->tv_nsec) / 1000000;
+}
+
+/*
+ * While a pty has synchronized output set, its windows are not drawn,
+ * so the screen shows the last complete frame.  An application that
+ * never resets the mode is drawn anyway after SYNC_TIMEOUT_MS.  Return
+ * the time until the next such timeout, or -1 if no pty is waiting.
+ */
+#define SYNC_TIMEOUT_MS 150
+static long
+expire_sync(void)
+{
+	long wait = -1;
+	for (struct pty *p = S.p; p; p = p->next) {
+		if (p->sync) {
+			long left = SYNC_TIMEOUT_MS - elapsed_ms(&p->synced);
+			if (left <= 0) {
+				p->sync = false;
+				S.redraw = MAX(S.redraw, 1);
+			} else if (wait == -1 || left < wait) {
+				wait = left;
 			}
 		}
 	}
+	return wait;
+}
+
+/*
+ * Each pty may have READ_QUOTA bytes or READ_SLICE_MS of parse time
+ * per frame, whichever is exhausted first.  A pty over quota is
+ * throttled: it is removed from the read set until the next frame, so
+ * a flooding child blocks on its own writes rather than starving the
+ * other ptys of parse and render time.  The buffer doubles (up to
+ * IOBUF_MAX) each time a read fills it completely.  Output that the
+ * event backend has already read is parsed first, and the pty is only
+ * read again if that filled the backend's buffer.
+ */
+#define READ_QUOTA (256 * 1024)
+#define READ_SLICE_MS 8
+#define IOBUF_MAX (64 * 1024)
+static void
+parse_output(struct pty *t, const char *b, size_t n)
+{
+	if (t->count || !defer(t, b, n)) {
+		flush_hidden(t);
+		vtwrite(&t->vp, b, n);
+	}
+	t->nread += n;
+}
+
+static void
+parse_pty(void *arg)
+{
+	static THREAD_LOCAL char *iobuf;
+	static THREAD_LOCAL size_t siz;
+	const struct event *e = arg;
+	struct pty *t = e->data;
+	size_t budget = READ_QUOTA - MIN(t->nread, READ_QUOTA);
+	int oldmax = t->s->maxy;
+	struct timespec start;
+	bool over = false;
+	bool more = e->buf == NULL || e->len == EV_BUFSIZ;
+	ssize_t r = e->buf ? (ssize_t)e->len : 1;
+	char *b;
+
+	if (iobuf == NULL && (iobuf = malloc(siz = BUFSIZ)) == NULL) {
+		siz = 0;
+	}
+	if (!check(iobuf != NULL, ENOMEM, "read buffer")) {
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (e->buf != NULL) {
+		parse_output(t, e->buf, e->len);
+		budget -= MIN(budget, e->len);
+	}
+	while (!(over = budget == 0 || elapsed_ms(&start) >= READ_SLICE_MS)
+			&& more) {
+		if ((r = read(t->fd, iobuf, MIN(siz, budget))) <= 0) {
+			break;
+		}
+		parse_output(t, iobuf, r);
+		budget -= r;
+		if ((size_t)r == siz && siz < IOBUF_MAX
+				&& (b = realloc(iobuf, 2 * siz)) != NULL) {
+			iobuf = b;
+			siz *= 2;
+		}
+	}
+	t->s->delta = t->s->maxy - oldmax;
+	t->throttled |= over;
+	t->eof = !over && r <= 0 && (r == 0 || (errno != EINTR
+		&& errno != EAGAIN && errno != EWOULDBLOCK));
+}
+
+/* Do what parse_pty leaves to the main thread */
+static void
+finish_read(struct pty *t)
+{
+	flush_later(t);
+	if (t->throttled) {
+		set_events(t);
+		S.redraw = MAX(S.redraw, 1); /* Ensure a frame to unthrottle */
+	} else if (t->eof) {
+		wait_child(t);
+	} else if (t->wq.len > t->wq.off) {
+		set_events(t);
+	}
+}
+
+static void
+readpty(struct event *e)
+{
+	parse_pty(e);
+	finish_read(e->data);
+}
+
+/*
+ * Parse the ready ptys in e, in parallel if there are threads for it.
+ * Nothing else touches a pty until every one is parsed (see worker.c).
+ */
+static void
+parse_ready(struct event *e, int n)
+{
+	void *arg[64];
+	if (S.jobs < 2 || n < 2) {
+		for (int i = 0; i < n; i++) {
+			readpty(e + i);
+		}
+		return;
+	}
+	for (int i = 0; i < n; i++) {
+		arg[i] = e + i;
+	}
+	S.parallel = true;
+	pool_run(parse_pty, arg, n);
+	S.parallel = false;
+	for (int i = 0; i < n; i++) {
+		finish_read(e[i].data);
+	}
+	tidy_pairs();
+}
+
+/*
+ * A burst of SIGWINCH is applied as a single resize at the next frame.
+ */
+static void
+getsignals(void)
+{
+	int sig;
+	while ((sig = ev_getsig()) > 0) {
+		if (sig == SIGWINCH) {
+			S.winch = true;
+			S.redraw = MAX(S.redraw, 1);
+		}
+	}
+	reap_children();
+}
+
+static void
+apply_winch(void)
+{
+	struct winsize ws;
+	if (check(ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0, 0, "TIOCGWINSZ")
+			&& ws.ws_row > 0 && ws.ws_col > 0) {
+		resizeterm(ws.ws_row, ws.ws_col);
+	}
+	reshape_root();
+	wrefresh(curscr);
+	S.winch = false;
+}
+
+/*
+ * Start a new frame: reset read quotas, resume throttled ptys and
+ * freeze the history written since the last frame.
+ */
+static void
+new_frame(void)
+{
+	for (struct pty *p = S.p; p; p = p->next) {
+		freeze_rows(p->scr, true);
+		p->rate = (p->rate + p->nread) / 2;
+		p->nread = 0;
+		if (p->throttled) {
+			p->throttled = false;
+			if (p->fd > 0) {
+				set_events(p);
+			}
+		}
+	}
+}
+
+/* Order ready ptys: the focused pty first, then the quietest. */
+static int
+by_priority(const void *a, const void *b)
+{
+	const struct pty *s = ((const struct event *)a)->data;
+	const struct pty *t = ((const struct event *)b)->data;
+	const struct pty *f = S.f ? S.f->p : NULL;
+	if ((s == f) != (t == f)) {
+		return s == f ? -1 : 1;
+	}
+	return (s->rate > t->rate) - (s->rate < t->rate);
+}
+
+/*
+ * Check stdin and all pty's for input, waiting at most timeout ms.
+ * Keystrokes request an immediate redraw, as does the first output
+ * from the focused pty after a keystroke so that echo is not delayed
+ * by the frame rate limit.  Other output is drawn at the next frame.
+ * Ready ptys are read in priority order (see by_priority).
+ */
+static void
+getinput(int timeout)
+{
+	struct event e[64];
+	int k = 0;
+	int n = ev_wait(e, sizeof e / sizeof *e, timeout);
+	if (n < 0) {
+		check(errno == EINTR, 0, "ev_wait");
+		return;
+	}
+	for (int i = 0; i < n; i++) {
+		if (e[i].fd == sigfd) {
+			getsignals();
+		}
+	}
+	for (int i = 0; i < n; i++) {
+		if (e[i].fd == STDIN_FILENO) {
+			getkeys();
+			S.redraw = 2;
+			S.echo = true;
+		}
+	}
+	for (int i = 0; i < n; i++) {
+		struct pty *t = e[i].data;
+		/* The fd may have been closed while handling keys */
+		if (t && t->fd == e[i].fd && (e[i].ev & EV_WRITE)) {
+			drain_wq(t);
+		}
+		if (t && t->fd == e[i].fd && (e[i].ev & EV_READ)) {
+			e[k++] = e[i];
+		}
+	}
+	qsort(e, k, sizeof *e, by_priority);
+	parse_ready(e, k);
+	for (int i = 0; i < k; i++) {
+		struct pty *t = e[i].data;
+		if (S.echo && S.f && t == S.f->p) {
+			S.echo = false;
+			S.redraw = 2;
+		}
+		S.redraw = MAX(S.redraw, t->count ? 1 : 0);
+	}
 }
 
 void
@@ -383,7 +830,7 @@ sendarrow(const char *k)
 {
 	struct canvas *n = S.f;
 	char buf[3] = { '\033', n->p->pnm ? 'O' : '[', *k };
-	rewrite(n->p->fd, buf, 3);
+	write_pty(n->p, buf, 3);
 }
 
 /*
@@ -425,29 +872,63 @@ update_offset_r(struct canvas *n)
 			if (t > 0) {
 				n->offset.y += MIN(d, t);
 			}
+			/* The screens differ in height */
+			n->offset.y = MAX(-spilled_rows(n->p->s),
+				MIN(n->offset.y, MAX(t, 0)));
 		}
 		update_offset_r(n->c[0]);
 		update_offset_r(n->c[1]);
 	}
 }
 
+static void
+render(struct timespec *t)
+{
+	if (S.winch) {
+		apply_winch();
+	}
+	if (S.reshape) {
+		reshape(S.root, 0, 0, LINES, COLS);
+		wrefresh(curscr);
+	}
+	draw(S.root);
+	if (*S.errmsg) {
+		mvwprintw(S.werr, 0, 0, "%s", S.errmsg);
+		wclrtoeol(S.werr);
+		draw_pane(S.werr, LINES - 1, 0);
+	}
+	fixcursor();
+	doupdate();
+	clock_gettime(CLOCK_MONOTONIC, t);
+	S.redraw = 0;
+	new_frame();
+}
+
+/*
+ * Parse input as it arrives, but redraw at most S.fps times per
+ * second.  If a redraw is pending but the frame interval has not
+ * elapsed, wait for input only until the next frame is due.
+ */
 static void
 main_loop(void)
 {
+	struct timespec last = { 0, 0 };
+	S.redraw = 2;
 	while (S.root != NULL) {
-		if (S.reshape) {
-			reshape(S.root, 0, 0, LINES, COLS);
-			wrefresh(curscr);
-		}
-		draw(S.root);
-		if (*S.errmsg) {
-			mvwprintw(S.werr, 0, 0, "%s", S.errmsg);
-			wclrtoeol(S.werr);
-			draw_pane(S.werr, LINES - 1, 0);
-		}
-		fixcursor();
-		doupdate();
-		getinput();
+		long timeout = expire_sync();
+		if (S.redraw || S.reshape) {
+			long wait = 0;
+			if (S.fps > 0 && S.redraw < 2 && !S.reshape) {
+				wait = 1000 / S.fps - elapsed_ms(&last);
+			}
+			if (wait > 0) {
+				timeout = timeout == -1 ? wait : MIN(timeout, wait);
+			} else {
+				render(&last);
+			}
+		}
+		getinput(timeout);
+		flush_visible();
 		update_offset_r(S.root);
 		for (struct pty *p = S.p; p; p = p->next) {
 			p->s->delta = 0;
@@ -458,18 +939,33 @@ main_loop(void)
 void
 endwin_wrap(void)
 {
+	putp("\033[?2004l");
 	(void)endwin();
 }
 
 static void
 init(void)
 {
+	const char *backend = getenv("SMTX_EVENTS");
 	signal(SIGTERM, exit);
-	FD_ZERO(&S.fds);
-	FD_SET(STDIN_FILENO, &S.fds);
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGCHLD);
+	sigaddset(&signals, SIGWINCH);
+	if (ev_init(backend) == NULL || !ev_set(STDIN_FILENO, EV_READ, NULL)
+			|| (sigfd = ev_signal(&signals)) == -1
+			|| !ev_set(sigfd, EV_READ, NULL)) {
+		errx(EXIT_FAILURE, "Unable to initialize event loop: %s",
+			S.errmsg);
+	}
+	if (S.jobs > 1) {
+		pool_init(S.jobs);
+	}
 	build_bindings();
 	atexit(endwin_wrap);
 	initscr(); /* exits on failure */
+	define_key("\033[200~", KEY_PASTE_BEGIN);
+	define_key("\033[201~", KEY_PASTE_END);
+	putp("\033[?2004h"); /* Enable bracketed paste */
 	S.history = MAX(LINES, S.history);
 	raw();
 	noecho();
@@ -480,12 +976,15 @@ init(void)
 	use_default_colors();
 	resize_pad(&S.werr, 1, COLS);
 	resize_pad(&S.wbkg, LINES, COLS);
+	resize_pad(&S.wpty, LINES, COLS);
+	resize_pad(&S.wkey, 1, 1);
 	wbkgd(S.wbkg, ACS_BULLET);
 	wborder(S.wbkg, ACS_VLINE, ACS_BULLET, ACS_BULLET, ACS_BULLET,
 		ACS_VLINE, ACS_BULLET, ACS_BULLET, ACS_BULLET);
 	wattron(S.werr, A_REVERSE);
 	S.f = S.root = newcanvas(NULL, NULL);
-	if (S.root == NULL || S.werr == NULL || S.wbkg == NULL || !S.root->p) {
+	if (S.root == NULL || S.werr == NULL || S.wbkg == NULL
+			|| S.wpty == NULL || S.wkey == NULL || !S.root->p) {
 		endwin();
 		errx(EXIT_FAILURE, "Unable to create root window");
 	}
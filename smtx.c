@@ -21,7 +21,7 @@ parse_args(int argc, char *const*argv)
 {
 	int c;
 	char *name = strrchr(argv[0], '/');
-	while ((c = getopt(argc, argv, ":c:hs:t:vw:")) != -1) {
+	while ((c = getopt(argc, argv, ":c:f:hj:s:S:t:vw:")) != -1) {
 		switch (c) {
 		default:
 			fprintf(stderr, "Unknown option: %c", optopt);
@@ -29,20 +29,32 @@ parse_args(int argc, char *const*argv)
 		case 'c':
 			S.ctlkey = CTRL(S.rawkey = optarg[0]);
 			break;
+		case 'f':
+			S.fps = strtol(optarg, NULL, 10);
+			break;
 		case 'h':
 			printf("usage: %s", name ? name + 1 : argv[0]);
 			puts(
 				" [-c ctrl-key]"
+				" [-f fps]"
 				" [-h]"
+				" [-j threads]"
 				" [-s history-size]"
+				" [-S spill-dir]"
 				" [-t terminal-type]"
 				" [-v]"
 				" [-w width]"
 			);
 			exit(EXIT_SUCCESS);
+		case 'j':
+			S.jobs = strtol(optarg, NULL, 10);
+			break;
 		case 's':
 			S.history = strtol(optarg, NULL, 10);
 			break;
+		case 'S':
+			S.spill = optarg;
+			break;
 		case 't':
 			S.term = optarg;
 			break;
@@ -55,36 +67,6 @@ parse_args(int argc, char *const*argv)
 	}
 }
 
-/* If rv is non-zero, emit the error message */
-int
-check(int rv, int err, const char *fmt, ...)
-{
-	if (!rv) {
-		int e = err ? err : errno;
-		va_list ap;
-		va_start(ap, fmt);
-		size_t len = sizeof S.errmsg;
-		int n = vsnprintf(S.errmsg, len, fmt, ap);
-		if (e && n + 3 < (int)len) {
-			strncat(S.errmsg, ": ", len - n);
-			strncat(S.errmsg, strerror(e), len - n - 2);
-		}
-		va_end(ap);
-	}
-	return !!rv;
-}
-
-void
-rewrite(int fd, const char *b, size_t n)
-{
-	const char *e = b + n;
-	ssize_t s;
-	if (n > 0 ) do {
-		s = write(fd, b, e - b);
-		b += s < 0 ? 0 : s;
-	} while (b < e && check(s >= 0 || errno == EINTR, 0, "write %d", fd) );
-}
-
 int
 main(int argc, char **argv)
 {
@@ -47,6 +47,7 @@
 #include <sys/select.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 #include <wchar.h>
 #include <wctype.h>
@@ -60,26 +61,59 @@ extern int smtx_main(void);
 #ifndef CTRL
 #define CTRL(x) ((x) & 0x1f)
 #endif
+#if HAVE_PTHREAD
+# define THREAD_LOCAL _Thread_local
+#else
+# define THREAD_LOCAL
+#endif
+
+struct buf {
+	char *b;
+	size_t off, len, siz; /* b[off] .. b[len - 1] is unconsumed */
+};
+extern int buf_append(struct buf *, const char *, size_t);
+
+/*
+ * A screen is a grid of cells whose rows form a ring: row y of s is
+ * line[(org + y) % rows], so the whole screen scrolls by moving org.
+ * Rows far above the cursor are frozen: their cells are freed and
+ * only a compressed copy is kept until they are needed (see grid.c).
+ */
+struct cell {
+	wchar_t c; /* 0 in the right half of a wide character */
+	attr_t a;
+	short p;   /* The color pair */
+};
+struct row {
+	struct cell *c;   /* NULL if the row is frozen */
+	unsigned char *z; /* The compressed cells of a frozen row */
+};
 
 struct canvas;
 struct screen {
 	int vis;   /* cursor visibility */
 	int maxy;  /* highest row in which the cursor has ever been */
-	int rows;  /* number of rows in the window */
+	int rows;  /* number of rows in the grid */
+	int cols;  /* number of columns in the grid */
 	int delta; /* number of lines written by a vtwrite */
 	struct { int top; int bot; } scroll;
 	struct {
 		int y, x, xenl;
-		cchar_t bkg;
+		struct cell bkg; /* Written by erase and scroll */
 		attr_t attr;
 		short p; /* The color pair */
-		short color[2]; /* [0] == foreground, [1] == background */
+		int color[2]; /* [0] == foreground, [1] == background */
 		wchar_t *gc, *gs;
 	} c, sc; /* cursor/save cursor */
 	bool insert;
 	wchar_t repc; /* character to be repeated */
 	int decawm;   /* wrap-around mode */
-	WINDOW *w;
+	struct row *line;
+	int cap;            /* Rows allocated in line */
+	struct cell *spare; /* Cells of a frozen row, for reuse */
+	struct spill *spill; /* Rows that scrolled off, or NULL */
+	int frozen;  /* Rows above this one are known to be frozen */
+	int org;
 };
 struct pty {
 	int fd, tabstop, count;
@@ -93,6 +127,17 @@ struct pty {
 	wchar_t *g[4];
 	char status[32];
 	struct vtp vp;
+	struct buf hidden; /* Output not yet parsed while count == 0 */
+	struct buf wq;     /* Input not yet accepted by the pty */
+	size_t nread;      /* Bytes read since the last frame */
+	size_t rate;       /* Decaying average of nread per frame */
+	bool throttled;    /* Read quota exhausted until the next frame */
+	bool reaped;       /* Child has exited and been waited for */
+	bool bpaste;       /* Bracketed paste mode (DECSET 2004) */
+	bool sync;         /* Synchronized output (DECSET 2026) */
+	struct timespec synced; /* When sync was set */
+	bool eof;          /* The last read found the end of output */
+	struct buf later;  /* Calls left to the main thread by run_later */
 	char secondary[PATH_MAX];
 	struct pty *next;
 };
@@ -121,6 +166,7 @@ struct state {
 	unsigned char rawkey;
 	int width;   /* Columns in newly created ptys */
 	int history; /* Rows in newly created windows */
+	const char *spill; /* Directory for rows beyond the history */
 	int count;   /* User entered count in command mode */
 	const char *term; /* Name of the terminal type */
 	struct handler *binding; /* Current key binding */
@@ -129,14 +175,37 @@ struct state {
 	struct pty *p;     /* List of all pty in use */
 	struct pty *tail;  /* Last in the list of p */
 	struct canvas *unused; /* Unused canvasses */
-	fd_set fds;
-	int maxfd;
 	WINDOW *werr;
 	WINDOW *wbkg;
+	WINDOW *wpty; /* The visible part of each pty is drawn here */
+	WINDOW *wkey; /* Keys are read from this pad */
 	int reshape;
+	int fps;     /* Maximum redraws per second (0 for no limit) */
+	int jobs;    /* Threads that parse ptys (see worker.c) */
+	bool parallel; /* Ptys are being parsed by several threads */
+	int redraw;  /* 0: screen is current, 1: at next frame, 2: now */
+	bool winch;  /* Terminal resized; applied at the next frame */
+	bool echo;   /* Expecting echo of a keystroke from focused pty */
 	char errmsg[256];
 };
 
+#define EV_READ  0x1
+#define EV_WRITE 0x2
+#define EV_DATA  0x4  /* With EV_READ: the backend may read fd itself */
+#define EV_BUFSIZ (16 * 1024)  /* Most bytes read by the backend at once */
+struct event {
+	int fd;
+	unsigned ev;  /* Mask of EV_READ and EV_WRITE */
+	void *data;   /* As given to ev_set */
+	const char *buf;  /* If not NULL, len bytes read from fd (EV_DATA) */
+	size_t len;
+};
+extern const char *ev_init(const char *);
+extern int ev_set(int fd, unsigned events, void *data);
+extern int ev_wait(struct event *e, int n, int timeout);
+extern int ev_signal(const sigset_t *);
+extern int ev_getsig(void);
+
 struct point { int y, x; };
 struct canvas {
 	struct point origin; /* position of upper left corner */
@@ -151,7 +220,7 @@ struct canvas {
 	left corner.  eg: if extent = {3, 13}, typ = 0, split = { 0.5, 0.333 }
 
 	             |<-wdiv
-	  p->s.w     |              c[1]
+	  p->s       |              c[1]
 	             |
 	----wtit-----x-------c[1]->wtit-----------
 
@@ -177,8 +246,10 @@ extern int id;
 
 extern struct canvas * newcanvas(struct pty *, struct canvas *);
 extern void draw(struct canvas *);
+extern void draw_title(struct canvas *, int);
 extern void setupevents(struct pty *);
 extern void rewrite(int fd, const char *b, size_t n);
+extern void write_pty(struct pty *, const char *b, size_t n);
 extern void draw(struct canvas *n);
 extern void freecanvas(struct canvas *n);
 extern void scrollbottom(struct canvas *n);
@@ -187,9 +258,29 @@ extern void set_tabs(struct pty *p, int tabstop);
 extern int resize_pad(WINDOW **, int, int);
 extern void reshape_window(struct pty *);
 extern void reshape(struct canvas *n, int y, int x, int h, int w);
+extern int resize_screen(struct screen *, int rows, int cols);
+extern void free_screen(struct screen *);
+extern struct cell *get_row(struct screen *, int y);
+extern const struct cell *peek_row(struct screen *, int y);
+extern const struct cell *hot_row(struct screen *, int y);
+extern short color_pair(int fg, int bg);
+extern void pair_colors(int pair, int *color);
+extern void tidy_pairs(void);
+extern int width(wchar_t);
+extern void freeze_rows(struct screen *, bool all);
+extern int spill_screen(struct screen *, const char *dir);
+extern int spilled_rows(const struct screen *);
+extern void drop_spill(struct screen *);
+extern void scroll_screen(struct screen *, int top, int bot, int n);
+extern void clear_rows(struct screen *, int top, int bot);
+extern void draw_screen(WINDOW *, struct point o, struct screen *,
+	struct point off, struct point extent);
 void set_scroll(struct screen *s, int top, int bottom);
 extern void change_count(struct canvas * n, int, int);
 extern struct pty * new_pty(int, int, bool);
+extern int pool_init(int);
+extern void pool_run(void (*)(void *), void **, int);
+extern void flush_later(struct pty *);
 
 extern action0 attach;
 extern action balance;
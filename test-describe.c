@@ -34,6 +34,7 @@ describe_layout(char *d, ptrdiff_t siz, const struct canvas *c, unsigned flags,
 	int show_2nd = flags & 0x40;
 	int human = flags & 0x80;
 	int show_pty = flags & 0x100;
+	int show_hot = flags & 0x200;
 
 	char *isfocus = recurse && c == S.f ? "*" : "";
 	if (human) {
@@ -52,6 +53,9 @@ describe_layout(char *d, ptrdiff_t siz, const struct canvas *c, unsigned flags,
 	if (! c->p->pnm) {
 		d += snprintf(d, e - d, "#"); /* Numeric keypad  */
 	}
+	if (c->p->sync) {
+		d += snprintf(d, e - d, "~"); /* Synchronized output */
+	}
 	if (show_2nd && c->p && c->p->fd != -1) {
 		d += snprintf(d, e - d, "(2nd=%s)", c->p->secondary );
 	}
@@ -63,6 +67,13 @@ describe_layout(char *d, ptrdiff_t siz, const struct canvas *c, unsigned flags,
 			c->p->scr[1].maxy
 		);
 	}
+	if (show_hot) {
+		int n = 0;
+		for (int y = 0; y < c->p->scr[0].rows; y++) {
+			n += hot_row(c->p->scr, y) != NULL;
+		}
+		d += snprintf(d, e - d, "(hot %d)", n);
+	}
 	for (int i = 0; recurse && i < 2; i ++) {
 		if (e - d > 3 + tab && c->c[i]) {
 			*d++ = human ? '\r' : ';';
@@ -124,7 +135,7 @@ color_name(short k)
 static size_t
 describe_row(char *desc, size_t siz, int row)
 {
-	int y, x;
+	int y = 0, x = 0;
 	size_t i = 0;
 	unsigned attrs = 0;
 	unsigned fgflag = 0;
@@ -134,7 +145,8 @@ describe_row(char *desc, size_t siz, int row)
 	const struct canvas *c = S.root;
 	unsigned width = c->p->ws.ws_col;
 	char *end = desc + siz;
-	WINDOW *w = c->p->s->w;
+	struct screen *s = c->p->s;
+	WINDOW *w = NULL;
 	struct {
 		unsigned attr;
 		unsigned flag;
@@ -156,13 +168,24 @@ describe_row(char *desc, size_t siz, int row)
 		row += c->offset.y;
 		offset = c->offset.x;
 	} else if (row == c->extent.y) {
+		/* Frames are capped, so bring the title up to date */
+		draw_title(S.root, S.binding == ctl && S.root == S.f);
 		w = c->wtit;
 		row = 0;
 	}
-	getyx(w, y, x);
+	if (w) {
+		getyx(w, y, x);
+	}
 	for (i = 0; i < (size_t)c->extent.x && i < width && desc < end; i++) {
 		int p;
-		chtype k = mvwinch(w, row, i + offset);
+		chtype k = ' ';
+		if (w) {
+			k = mvwinch(w, row, i + offset);
+		} else if (row < s->rows && i + offset < (size_t)s->cols) {
+			const struct cell *e = peek_row(s, row) + i + offset;
+			k = (e->c ? e->c & A_CHARTEXT : ' ') | e->a
+				| COLOR_PAIR(e->p);
+		}
 		for (atrp = atrs; atrp->flag; atrp += 1) {
 			check_attr(atrp->flag, &attrs, &desc, end, atrp->name,
 				( (k & A_ATTRIBUTES) & atrp->attr ) ? 1 : 0, 0
@@ -186,7 +209,9 @@ describe_row(char *desc, size_t siz, int row)
 		}
 		*desc++ = k & A_CHARTEXT;
 	}
-	wmove(w, y, x);
+	if (w) {
+		wmove(w, y, x);
+	}
 	return siz - ( end - desc );
 }
 
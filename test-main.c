@@ -216,6 +216,27 @@ grep(int fd, const char *needle)
 	}
 }
 
+/*
+ * Wait until row begins with s.  Like grep, this only delays the test,
+ * but it looks at the screen rather than the output: output drawn in
+ * the same frame as similar text may be written as only the cells
+ * that differ (eg, a prompt that changes from un1> to un2>).
+ */
+void
+wait_for_row(int fd, int row, const char *s)
+{
+	char buf[1024];
+	struct timespec t = { 0, 10 * 1000 * 1000 };
+	for (int i = 0; read_timeout == 0 || i < 100 * read_timeout; i++) {
+		if (get_row(fd, row, buf, sizeof buf) == 0
+				&& strncmp(buf, s, strlen(s)) == 0) {
+			return;
+		}
+		nanosleep(&t, NULL);
+	}
+	errx(EXIT_FAILURE, "timedout waiting for %s in row %d", s, row);
+}
+
 static int
 get_secondary_fd(int fd)
 {
@@ -640,6 +661,10 @@ initialize_tests(char const **argv0)
 	F(test_ed);
 	F(test_el);
 	F(test_equalize);
+	F(test_flood);
+	F(test_freeze);
+	F(test_fps, "args", "-f", "4");
+	F(test_hidden);
 	F(test_hpr);
 	F(test_ich);
 	F(test_insert);
@@ -652,10 +677,14 @@ initialize_tests(char const **argv0)
 	F(test_navigate);
 	F(test_nel, "TERM", "smtx");
 	F(test_pager ,"MORE", "");
+	F(test_pairs, "TERM", "xterm");
+	F(test_paste);
 	F(test_pnm);
 	F(test_prune);
+	F(test_queue);
 	F(test_repc);
 	F(test_resend);
+	F(test_reap);
 	F(test_resize);
 	F(test_resizepty, "args", "-s", "10");
 	F(test_ri);
@@ -664,15 +693,21 @@ initialize_tests(char const **argv0)
 	F(test_scrollh, "COLUMNS", "26", "args", "-w", "78");
 	F(test_scs);
 	F(test_sgr);
+	F(test_sgr_private);
+	F(test_spill, "args", "-s", "30", "-S", ".");
 	F(test_su);
 	F(test_swap);
+	F(test_sync);
 	F(test_tabstop);
+	F(test_threads, "args", "-j", "4");
 	F(test_title);
 	F(test_tput);
 	F(test_transpose);
+	F(test_truecolor);
 	F(test_utf);
 	F(test_vis);
 	F(test_wait);
 	F(test_width);
+	F(test_wrap);
 	return tab;
 }
@@ -48,6 +48,17 @@ test_alt(int fd)
 	for (int i = 3; i < 24; i++) {
 		rv |= validate_row(fd, i, "%-80s", "");
 	}
+
+	/* The alternate screen is drawn at the top after the primary scrolls */
+	send_txt(fd, "rs5>", "PS1=rs'5> '; printf '\\033[1047l'; seq 40");
+	send_txt(fd, "tu6>", "PS1=tu'6> '; printf '\\033[1047h'; echo alt 3");
+	rv |= validate_row(fd, 1, "%-80s", "alt 3");
+	rv |= validate_row(fd, 2, "%-80s", "tu6>");
+
+	/* The alternate screen has no history and follows the window */
+	rv |= check_layout(fd, 0x100, "23x80(pri 1024,47)(2nd 23,22)");
+	send_cmd(fd, NULL, "c");
+	rv |= check_layout(fd, 0x100, "11x80(pri 1024,47)(2nd 11,10)");
 	return rv;
 }
 
@@ -139,7 +150,8 @@ test_changehist(int fd)
 
 	send_cmd(fd, NULL, "200Z"); /* Increase history to 200 */
 	const char *cmd = "PS1=un'2>'; yes | nl -s '' | sed 127q";
-	send_txt(fd, "un2", "%s", cmd);
+	send_txt(fd, NULL, "%s", cmd);
+	wait_for_row(fd, 23, "un2>");
 	rv |= validate_row(fd, -176, "    57%-74s", "y");
 	rv |= validate_row(fd, -106, "   127%-74s", "y");
 	rv |= validate_row(fd, -105, "un1>%-76s", cmd);
@@ -483,6 +495,85 @@ test_equalize(int fd)
 	return status;
 }
 
+int
+test_fps(int fd)
+{
+	/* Output is parsed as it arrives even if redraws are delayed */
+	send_txt(fd, "uniq1", "%s; %s", "yes | nl -ba | sed 400q",
+		"printf 'uniq%s\\n' 1");
+	int rv = validate_row(fd, 21, "%6d%-74s", 400, "  y");
+	rv |= validate_row(fd, 22, "%-80s", "uniq1");
+	return rv;
+}
+
+int
+test_flood(int fd)
+{
+	/* A pty flooding output does not starve the focused pty */
+	int rv = validate_row(fd, 1, "%-80s", PROMPT);
+	send_cmd(fd, NULL, "c");
+	send_cmd(fd, "flood", "j\ryes flo'od'\r");
+	send_cmd(fd, NULL, "k");
+	send_txt(fd, "quiet", "printf 'qu%%s\\n' iet");
+	rv |= validate_row(fd, 2, "%-80s", "quiet");
+	rv |= validate_row(fd, 3, "%-80s", PROMPT);
+	send_cmd(fd, NULL, "j");
+	send_raw(fd, NULL, "\003");
+	return rv;
+}
+
+int
+test_freeze(int fd)
+{
+	/* Rows far above the cursor are compressed and read back intact */
+	int rv = validate_row(fd, 1, "%-80s", PROMPT);
+	send_txt(fd, "ab1>", "PS1=ab'1>'; printf 'a\\033[31mbbbbbbb\\033[mc"
+		"%%20sxxxxxyz\\n'; seq 300");
+	rv |= validate_row(fd, -278, "a<red>bbbbbbb</red>c%20sxxxxxyz%44s",
+		"", "");
+	rv |= validate_row(fd, -277, "%-80s", "1");
+	rv |= validate_row(fd, 22, "%-80s", "300");
+	rv |= check_layout(fd, 0x200, "23x80(hot 256)");
+
+	/* Frozen rows survive a change of history */
+	send_cmd(fd, NULL, "2000Z");
+	send_txt(fd, "cd2>", "PS1=cd'2>'");
+	rv |= validate_row(fd, -279, "a<red>bbbbbbb</red>c%20sxxxxxyz%44s",
+		"", "");
+
+	/* And are cleared with the rest of the history */
+	send_txt(fd, "ef3>", "PS1=ef'3>'; printf '\\033[3J'");
+	rv |= validate_row(fd, -280, "%-80s", "");
+	rv |= validate_row(fd, -279, "%-80s", "");
+
+	/* An erase with a background thaws every row, but those more than
+	HOT_ROWS above the cursor are frozen again at the next newline */
+	send_txt(fd, "gh4>", "PS1=gh'4>'; "
+		"printf '\\033[41m\\033[3J\\033[m\\n'");
+	rv |= check_layout(fd, 0x200, "23x80(hot 973)");
+	return rv;
+}
+
+int
+test_hidden(int fd)
+{
+	/* Output written while a pty is not visible appears when attached */
+	int rv = validate_row(fd, 1, "%-80s", PROMPT);
+	send_txt(fd, "un1>", "PS1=un'1>'; rm -f hidden.fifo; "
+		"mkfifo hidden.fifo");
+	send_txt(fd, "uniq2", "{ read x < hidden.fifo; yes | nl | sed 30q; "
+		"echo hid'den'; } & echo u'n'iq2");
+	send_cmd(fd, "ab3>", "N\rPS1=ab'3> '");
+	rv |= check_layout(fd, 0x5, "*23x80(id=2)");
+	send_txt(fd, "cd4>", "echo > hidden.fifo; rm hidden.fifo; "
+		"sleep .5; PS1=cd'4> '");
+	send_cmd(fd, NULL, "1a");
+	rv |= check_layout(fd, 0x5, "*23x80(id=1)");
+	rv |= validate_row(fd, 21, "%-80s", "    30  y");
+	rv |= validate_row(fd, 22, "%-80s", "hidden");
+	return rv;
+}
+
 int
 test_hpr(int fd)
 {
@@ -833,6 +924,35 @@ test_pager(int fd)
 	return rv;
 }
 
+int
+test_pairs(int fd)
+{
+	/* Pairs are freed when all are in use, but a row in the history
+	keeps its colors */
+	int rv = validate_row(fd, 1, "%-80s", PROMPT);
+	send_txt(fd, "ab1>", "PS1=ab'1>'; printf '\\033[31mred\\033[m\\n'; "
+		"i=0; while [ $i -lt 300 ]; do printf '\\033[3%%d;4%%dmx"
+		"\\033[m\\n' $((i %% 8)) $((i / 8 %% 8)); i=$((i + 1)); done");
+	rv |= validate_row(fd, -278, "%-91s", "<red>red</red>");
+	return rv;
+}
+
+int
+test_paste(int fd)
+{
+	/* Pasted text is sent verbatim, with brackets only if requested */
+	int rv = validate_row(fd, 1, "%-80s", PROMPT);
+	send_txt(fd, "ready", "stty -echo; echo re'ad'y; cat -v; "
+		"printf '\\033[?2004h'; echo s'e't; cat -v; stty echo");
+	send_raw(fd, "x^Gy", "\033[200~x%cy\r\033[201~\004", ctlkey);
+	grep(fd, "set");
+	send_raw(fd, "201~", "\033[200~x%cy\r\033[201~\r\004", ctlkey);
+	rv |= validate_row(fd, 4, "%-80s", "x^Gy");
+	rv |= validate_row(fd, 6, "%-80s", "^[[200~x^Gy");
+	rv |= validate_row(fd, 7, "%-80s", "^[[201~");
+	return rv;
+}
+
 int
 test_pnm(int fd)
 {
@@ -876,6 +996,25 @@ test_prune(int fd)
 	return rv;
 }
 
+int
+test_queue(int fd)
+{
+	/* Input the child is not yet reading must not be dropped */
+	char buf[1001];
+	int rv = validate_row(fd, 1, "%-80s", PROMPT);
+	memset(buf, 'x', sizeof buf - 1);
+	buf[sizeof buf - 1] = '\0';
+	send_txt(fd, "ready", "PS1=un'1>'; stty -icanon -echo; echo r'e'ady; "
+		"sleep .5; head -c 200000 | wc -c | tr -d ' '; stty sane");
+	for (int i = 0; i < 200; i++) {
+		send_raw(fd, NULL, "%s", buf);
+	}
+	grep(fd, "un1>");
+	rv |= validate_row(fd, 3, "%-80s", "ready");
+	rv |= validate_row(fd, 4, "%-80s", "200000");
+	return rv;
+}
+
 int
 test_repc(int fd)
 {
@@ -894,6 +1033,22 @@ test_resend(int fd)
 	return rv;
 }
 
+int
+test_reap(int fd)
+{
+	/* A child is reaped when it exits, while its pty is still open */
+	char title[81];
+	int rv = validate_row(fd, 1, "%-80s", PROMPT);
+	send_txt(fd, "uniq", "sleep 3 & echo un'i'q; exit 5");
+	/* The shell may still be exiting when uniq is drawn */
+	grep(fd, "exited 5");
+	memset(title, 'q', 80);
+	memcpy(title, "1 exited 5 ", 11);
+	title[80] = '\0';
+	rv |= validate_row(fd, 24, "%s", title);
+	return rv;
+}
+
 int
 test_resize(int fd)
 {
@@ -1332,6 +1487,40 @@ test_sgr(int fd)
 	return rv ? 77 : 0;
 }
 
+int
+test_sgr_private(int fd)
+{
+	/* CSI > m is not an SGR, and does not hide an SGR next to it */
+	int rv = validate_row(fd, 1, "%-80s", PROMPT);
+	send_txt(fd, "un1>", "PS1=un'1>'; clear; printf 'a\\033[1m\\033[>1mb"
+		"\\033[0m\\033[>1m\\033[1mc\\033[0m\\033[>1md\\n'");
+	rv |= validate_row(fd, 1, "%-93s", "a<bold>bc</bold>d");
+	return rv;
+}
+
+int
+test_spill(int fd)
+{
+	/* Rows beyond the history are read back from the spill */
+	int rv = validate_row(fd, 1, "%-80s", PROMPT);
+	send_cmd(fd, NULL, "c");
+	const char *cmd = "PS1=ab'1>'; seq 100";
+	send_txt(fd, "ab1>", "%s", cmd);
+	rv |= validate_row(fd, 9, "%-80s", "99");
+
+	/* Scroll back in the top window, and type in the bottom one */
+	send_cmd(fd, "foobar", "60bj\rprintf 'foo%%s' bar");
+	rv |= validate_row(fd, 0, "%-80s", "30");
+	rv |= validate_row(fd, 9, "%-80s", "39");
+	send_cmd(fd, "foobaz", "k200bj\rprintf 'foo%%s' baz");
+	rv |= validate_row(fd, 0, "%-80s", "");
+	rv |= validate_row(fd, 1, "%s%-76s", PROMPT, cmd);
+	for (int i = 2; i < 11; i++) {
+		rv |= validate_row(fd, i, "%-80d", i - 1);
+	}
+	return rv;
+}
+
 int
 test_su(int fd)
 {
@@ -1421,6 +1610,33 @@ test_swap(int fd)
 	return rv ? 77 : 0;
 }
 
+int
+test_sync(int fd)
+{
+	/* Output during a synchronized update is drawn when it ends */
+	send_txt(fd, "uniq1", "printf '\\033[?2026hfoo\\n\\033[?2026l';"
+		" echo u'n'iq1");
+	int rv = validate_row(fd, 2, "%-80s", "foo");
+
+	/* An update that is never ended is drawn after a timeout, so
+	uniq2 is not seen until then */
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	send_txt(fd, "uniq2", "printf '\\033[?2026hbar\\n'; echo u'n'iq2");
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	long ms = (t1.tv_sec - t0.tv_sec) * 1000
+		+ (t1.tv_nsec - t0.tv_nsec) / 1000000;
+	if (ms < 100) {
+		fprintf(stderr, "sync update drawn after %ldms\n", ms);
+		rv = 1;
+	}
+	rv |= check_layout(fd, 0x1, "*23x80");
+	rv |= validate_row(fd, 5, "%-80s", "bar");
+	send_txt(fd, "uniq3", "printf '\\033[?2026l'; echo u'n'iq3");
+	rv |= validate_row(fd, 8, "%-80s", "uniq3");
+	return rv;
+}
+
 int
 test_tabstop(int fd)
 {
@@ -1482,6 +1698,30 @@ test_title(int fd)
 	return rv;
 }
 
+int
+test_threads(int fd)
+{
+	/* Ptys that are busy at once are parsed in parallel, intact */
+	int rv = validate_row(fd, 1, "%-80s", PROMPT);
+	send_txt(fd, "un1>", "PS1=un'1>'; rm -f go1 go2 done; "
+		"mkfifo go1 go2 done");
+	send_txt(fd, "uniq2", "{ read x < go1; seq 5000; echo fin'ish1'; "
+		"echo > done; } & echo u'n'iq2");
+	send_cmd(fd, "ab3>", "cj\rPS1=ab'3> '");
+	rv |= check_layout(fd, 0x5, "11x80(id=1); *11x80(id=2)");
+	/* Each job has its own fifo, so that both are sure to start */
+	send_txt(fd, "cd4>", "( { read x < go2; seq 5000; echo fin'ish2'; } & "
+		"echo > go1 & echo > go2; wait; read x < done ); "
+		"rm go1 go2 done; PS1=cd'4> '");
+	rv |= validate_row(fd, 9, "%-80s", "5000");
+	rv |= validate_row(fd, 10, "%-80s", "finish1");
+	send_cmd(fd, NULL, "k2a");
+	rv |= check_layout(fd, 0x5, "*11x80(id=2); 11x80(id=2)");
+	rv |= validate_row(fd, 9, "%-80s", "5000");
+	rv |= validate_row(fd, 10, "%-80s", "finish2");
+	return rv;
+}
+
 int
 test_tput(int fd)
 {
@@ -1532,6 +1772,35 @@ test_transpose(int fd)
 	return rv;
 }
 
+int
+test_truecolor(int fd)
+{
+	/* Direct colors consume their parameters, in either form, and
+	colon subparameters are not read as attributes */
+	const char *sgr[] = {
+		"38;2;1;2;3;39;4",
+		"38:2:1:2:3;39;4",
+		"48:2::1:2:3;49;4",
+		"4:3",
+		NULL
+	};
+	int rv = 0;
+	for (int i = 0; sgr[i]; i++) {
+		char uniq[16];
+		snprintf(uniq, sizeof uniq, "uniq%d", i);
+		send_txt(fd, uniq, "printf 'foo\\033[%smbar\\033[m"
+			"baz\\n'; printf 'un%%s\\n' iq%d", sgr[i], i);
+		rv |= validate_row(fd, 2 + 3 * i, "%-89s", "foo<ul>bar</ul>baz");
+	}
+
+	/* Dropped subparameters do not leak into the next sequence */
+	send_txt(fd, "uniq9", "printf 'foo\\033[4:3mbar\\033[0;5mbaz"
+		"\\033[m\\n'; printf 'un%%s\\n' iq9");
+	rv |= validate_row(fd, 14, "%-104s",
+		"foo<ul>bar</ul><blink>baz</blink>");
+	return rv;
+}
+
 int
 test_utf(int fd)
 {
@@ -1659,3 +1928,20 @@ test_width(int fd)
 
 	return rv;
 }
+
+int
+test_wrap(int fd)
+{
+	int rv = validate_row(fd, 1, "%-80s", PROMPT);
+	send_txt(fd, "uniq1", "printf '%%090d\\n' 7; printf 'uniq%%s\\n' 1");
+	rv |= validate_row(fd, 2, "%080d", 0);
+	rv |= validate_row(fd, 3, "%-80s", "0000000007");
+	rv |= validate_row(fd, 4, "%-80s", "uniq1");
+
+	/* With autowrap off, the last column is overwritten */
+	send_txt(fd, "uniq2", "clear; printf '\\033[?7l%%090d\\033[?7h\\n' 8; "
+		"printf 'uniq%%s\\n' 2");
+	rv |= validate_row(fd, 1, "%079d8", 0);
+	rv |= validate_row(fd, 2, "%-80s", "uniq2");
+	return rv;
+}
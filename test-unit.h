@@ -28,6 +28,7 @@
 #include <sys/ioctl.h>
 #include <sys/select.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 #if HAVE_PTY_H
 # include <pty.h>
@@ -61,6 +62,7 @@ int get_layout(int fd, int flag, char *layout, size_t siz);
 int get_state(int fd, char *state, size_t siz);
 int get_row(int fd, int row, char *buf, size_t siz);
 void grep(int fd, const char *needle);
+void wait_for_row(int fd, int row, const char *s);
 
 int __attribute__((format(printf,3,4)))
 check_layout(int fd, int flag, const char *fmt, ...);
@@ -83,6 +85,10 @@ test test_ech;
 test test_ed;
 test test_el;
 test test_equalize;
+test test_flood;
+test test_freeze;
+test test_fps;
+test test_hidden;
 test test_hpr;
 test test_ich;
 test test_insert;
@@ -95,10 +101,14 @@ test test_mode;
 test test_navigate;
 test test_nel;
 test test_pager;
+test test_pairs;
+test test_paste;
 test test_pnm;
 test test_prune;
+test test_queue;
 test test_repc;
 test test_resend;
+test test_reap;
 test test_resize;
 test test_resizepty;
 test test_ri;
@@ -107,13 +117,19 @@ test test_scrollback;
 test test_scrollh;
 test test_scs;
 test test_sgr;
+test test_sgr_private;
+test test_spill;
 test test_su;
 test test_swap;
+test test_sync;
 test test_transpose;
+test test_truecolor;
 test test_title;
+test test_threads;
 test test_tput;
 test test_tabstop;
 test test_utf;
 test test_vis;
 test test_wait;
 test test_width;
+test test_wrap;
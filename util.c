@@ -0,0 +1,74 @@
+/*
+ * Copyright 2020 - 2023 William Pursell <william.r.pursell@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Helpers shared by smtx and the programs that link its objects without
+ * smtx.c (see bench-vtparser.c).
+ */
+#include "smtx.h"
+
+/* If rv is non-zero, emit the error message */
+int
+check(int rv, int err, const char *fmt, ...)
+{
+	if (!rv) {
+		int e = err ? err : errno;
+		va_list ap;
+		va_start(ap, fmt);
+		size_t len = sizeof S.errmsg;
+		int n = vsnprintf(S.errmsg, len, fmt, ap);
+		if (e && n + 3 < (int)len) {
+			strncat(S.errmsg, ": ", len - n);
+			strncat(S.errmsg, strerror(e), len - n - 2);
+		}
+		va_end(ap);
+	}
+	return !!rv;
+}
+
+void
+rewrite(int fd, const char *b, size_t n)
+{
+	const char *e = b + n;
+	ssize_t s;
+	if (n > 0 ) do {
+		s = write(fd, b, e - b);
+		b += s < 0 ? 0 : s;
+	} while (b < e && check(s >= 0 || errno == EINTR, 0, "write %d", fd) );
+}
+
+/* Append n bytes to the buffer, growing it as needed */
+int
+buf_append(struct buf *b, const char *s, size_t n)
+{
+	if (b->off > 0 && b->len + n > b->siz) {
+		memmove(b->b, b->b + b->off, b->len -= b->off);
+		b->off = 0;
+	}
+	if (b->len + n > b->siz) {
+		size_t siz = MAX(b->len + n, 2 * b->siz);
+		char *t = realloc(b->b, siz);
+		if (!check(t != NULL, ENOMEM, "realloc")) {
+			return 0;
+		}
+		b->b = t;
+		b->siz = siz;
+	}
+	memcpy(b->b + b->len, s, n);
+	b->len += n;
+	return 1;
+}
@@ -16,23 +16,68 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <assert.h>
+#include <langinfo.h>
 #include <stdlib.h>
 #include <string.h>
 #include "vtparser.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-struct action {
-	void (*cb)(struct vtp *p, wchar_t w);
-	struct state *next;
+/*
+ * The parser is a single [state][byte] transition table.  Each entry
+ * packs an action in its low three bits and, above them, the next state
+ * plus one.  An entry with no next state leaves the state unchanged.
+ */
+enum state {
+	ground, esc_entry, esc_collect,
+	csi_entry, csi_ignore, csi_param, csi_collect,
+	osc_param, osc_string
 };
-struct state {
-	int reset;
-	int *lut;
-	struct action act[0x80];
+enum action { NONE, SEND, COLLECT, COLLECT_OSC, PARAM, HANDLE_OSC };
+#define GO(a, s) ((a) | ((s) + 1) << 3)
+
+/* States that reset the parameters on entry */
+static const unsigned resets = 1 << ground | 1 << esc_entry;
+
+static int *const luts[] = {
+	[ground] = gnds,
+	[esc_entry ... esc_collect] = escs,
+	[csi_entry ... csi_collect] = csis,
+	[osc_param ... osc_string] = oscs,
 };
 
-static struct state ground, esc_entry, esc_collect,
-	csi_entry, csi_ignore, csi_param, csi_collect,
-	osc_param, osc_string;
+static void
+vtflush(struct vtp *v)
+{
+	if (v->nops > 0) {
+		(v->apply ? v->apply : vtapply)(v->p, v->ops, v->nops);
+		v->nops = 0;
+	}
+}
+
+static struct vtop *
+vtemit(struct vtp *v, int cmd)
+{
+	if (v->nops == VTOPS) {
+		vtflush(v);
+	}
+	struct vtop *o = v->ops + v->nops++;
+	o->cmd = cmd;
+	return o;
+}
+
+void
+vtapply(struct pty *p, struct vtop *o, int n)
+{
+	for (; n > 0; n--, o++) {
+		if (o->cmd == prun) {
+			tprint(p, o->run.s, o->run.n);
+		} else {
+			tput(p, o->w, o->iw, o->argc, o->args, o->cmd);
+		}
+	}
+}
 
 static void
 collect(struct vtp *v, wchar_t w)
@@ -48,12 +93,44 @@ collect_osc(struct vtp *v, wchar_t w)
 	}
 }
 
+/*
+ * Close a group of colon separated subparameters.  The ITU form of a
+ * direct color, 38:2:id:r:g:b, loses its color space id so that it reads
+ * like 38;2;r;g;b, and other groups keep only their first parameter.
+ */
+static void
+end_group(struct vtp *v)
+{
+	int *a = v->args + v->group;
+	int n = (v->argc < MAXPARAM ? v->argc : MAXPARAM) - v->group;
+	if (!v->colon) {
+		return;
+	}
+	v->colon = 0;
+	if (n > 1 && (a[0] == 38 || a[0] == 48)) {
+		if (a[1] == 2 && n > 5) {
+			memmove(a + 2, a + 3, (n - 3) * sizeof *a);
+			a[n - 1] = 0;
+			v->argc -= 1;
+		}
+	} else if (n > 1) {
+		/* Clear the dropped subparameters, which vtreset will not */
+		memset(a + 1, 0, (n - 1) * sizeof *a);
+		v->argc = v->group + 1;
+	}
+}
+
 static void
 param(struct vtp *v, wchar_t w)
 {
 	v->argc = v->argc ? v->argc : 1;
 	int *a = v->args + v->argc - 1;
 	if (w == L';') {
+		end_group(v);
+		v->group = v->argc;
+		v->argc += 1;
+	} else if (w == L':') {
+		v->colon = 1;
 		v->argc += 1;
 	} else if (v->argc < MAXPARAM && *a < 9999) {
 		*a = *a * 10 + w - '0';
@@ -61,14 +138,21 @@ param(struct vtp *v, wchar_t w)
 }
 
 static void
-handle_osc(struct vtp *v, wchar_t unused)
+layout(const char *arg)
+{
+	build_layout(arg);
+}
+
+static void
+handle_osc(struct vtp *v)
 {
-	(void)unused;
+	*v->osc = '\0';
+	vtflush(v);
 	switch (v->args[0]) {
 	case  2: set_status(v->p, v->oscbuf); break;
-	case 60: build_layout(v->oscbuf); break;
+	case 60: run_later(v->p, layout, v->oscbuf); break;
 #ifndef NDEBUG
-	case 62: show_status(v->oscbuf); break;
+	case 62: run_later(v->p, show_status, v->oscbuf); break;
 #endif
 	}
 }
@@ -76,7 +160,22 @@ handle_osc(struct vtp *v, wchar_t unused)
 static void
 send(struct vtp *v, wchar_t w)
 {
-	tput(v->p, w, v->inter, v->argc, v->args, v->s->lut[w]);
+	int cmd = luts[v->s][w];
+	end_group(v);
+	int argc = v->argc < MAXPARAM ? v->argc : MAXPARAM;
+	struct vtop *o = v->nops ? v->ops + v->nops - 1 : NULL;
+
+	/* Applying an SGR is idempotent, so drop a repeat of the last op */
+	if (cmd == sgr && o && o->cmd == sgr && o->iw == v->inter
+			&& o->argc == argc
+			&& !memcmp(o->args, v->args, argc * sizeof *o->args)) {
+		return;
+	}
+	o = vtemit(v, cmd);
+	o->w = w;
+	o->iw = v->inter;
+	o->argc = argc;
+	memcpy(o->args, v->args, argc * sizeof *o->args);
 }
 
 /*
@@ -84,153 +183,251 @@ send(struct vtp *v, wchar_t w)
  * Paul Flo Williams: http://vt100.net/emu/dec_ansi_parser
  * Please note that Williams does not (AFAIK) endorse this work.
  */
- #define LOWBITS                                      \
-		[0]             = {NULL, NULL},       \
-		[0x01 ... 0x17] = {send, NULL},       \
-		[0x18]          = {send, &ground},    \
-		[0x19]          = {send, NULL},       \
-		[0x1a]          = {send, &ground},    \
-		[0x1b]          = {NULL, &esc_entry}, \
-		[0x1c ... 0x1f] = {send, NULL}
+#define LOWBITS                                     \
+		[0]             = NONE,                 \
+		[0x01 ... 0x17] = SEND,                 \
+		[0x18]          = GO(SEND, ground),     \
+		[0x19]          = SEND,                 \
+		[0x1a]          = GO(SEND, ground),     \
+		[0x1b]          = GO(NONE, esc_entry),  \
+		[0x1c ... 0x1f] = SEND
 
-static struct state ground = {
-	.reset = 1,
-	.lut = gnds,
-	.act = {
+#pragma GCC diagnostic ignored "-Woverride-init"
+static const unsigned char table[osc_string + 1][0x80] = {
+	[ground] = {
 		LOWBITS,
-		[0x20 ... 0x7f] = {send, NULL},
-	}
-};
-
-static struct state esc_entry = {
-	.reset = 1,
-	.lut = escs,
-	.act = {
+		[0x20 ... 0x7f] = SEND,
+	},
+	[esc_entry] = {
 		LOWBITS,
-		[0x20]          = {collect, &esc_collect}, /* sp */
-		[0x21]          = {NULL, &osc_string},     /* ! */
-		[0x22 ... 0x2f] = {collect, &esc_collect}, /* "#$%&'()*+,-./ */
-		[0x30 ... 0x4f] = {send, &ground},
-		[0x50]          = {NULL, &osc_string},  /* P */
-		[0x51 ... 0x57] = {send, &ground},
-		[0x58]          = {NULL, NULL},
-		[0x59 ... 0x5a] = {send, &ground},
-		[0x5b]          = {NULL, &csi_entry},   /* [ */
-		[0x5c]          = {send, &ground},      /* \ */
-		[0x5d]          = {NULL, &osc_param},  /* ] */
-		[0x5e]          = {NULL, &osc_string},  /* ^ */
-		[0x5f]          = {NULL, &osc_string},  /* _ */
-		[0x60 ... 0x6a] = {send, &ground},      /* `a-j */
-		[0x6b]          = {NULL, &osc_string},  /* k */
-		[0x6c ... 0x7e] = {send, &ground},      /* l-z{|}~ */
-		[0x7f]          = {NULL, NULL},
-	}
-};
-
-static struct state esc_collect = {
-	.reset = 0,
-	.lut = escs,
-	.act = {
+		[0x20]          = GO(COLLECT, esc_collect), /* sp */
+		[0x21]          = GO(NONE, osc_string),     /* ! */
+		[0x22 ... 0x2f] = GO(COLLECT, esc_collect), /* "#$%&'()*+,-./ */
+		[0x30 ... 0x4f] = GO(SEND, ground),
+		[0x50]          = GO(NONE, osc_string),  /* P */
+		[0x51 ... 0x57] = GO(SEND, ground),
+		[0x58]          = NONE,
+		[0x59 ... 0x5a] = GO(SEND, ground),
+		[0x5b]          = GO(NONE, csi_entry),   /* [ */
+		[0x5c]          = GO(SEND, ground),      /* \ */
+		[0x5d]          = GO(NONE, osc_param),   /* ] */
+		[0x5e]          = GO(NONE, osc_string),  /* ^ */
+		[0x5f]          = GO(NONE, osc_string),  /* _ */
+		[0x60 ... 0x6a] = GO(SEND, ground),      /* `a-j */
+		[0x6b]          = GO(NONE, osc_string),  /* k */
+		[0x6c ... 0x7e] = GO(SEND, ground),      /* l-z{|}~ */
+		[0x7f]          = NONE,
+	},
+	[esc_collect] = {
 		LOWBITS,
-		[0x20 ... 0x2f] = {collect, NULL}, /* sp!"#$%&'()*+,-./ */
-		[0x30 ... 0x7e] = {send, &ground}, /* 0-9a-zA-z ... */
-		[0x7f]          = {NULL, NULL},
-	}
-};
-
-static struct state csi_entry = {
-	.reset = 0,
-	.lut = csis,
-	.act = {
+		[0x20 ... 0x2f] = COLLECT,          /* sp!"#$%&'()*+,-./ */
+		[0x30 ... 0x7e] = GO(SEND, ground), /* 0-9a-zA-z ... */
+		[0x7f]          = NONE,
+	},
+	[csi_entry] = {
 		LOWBITS,
-		[0x20 ... 0x2f] = {collect, &csi_collect}, /* !"#$%&'()*+,-./ */
-		[0x30 ... 0x39] = {param, &csi_param},     /* 0 - 9 */
-		[0x3a]          = {NULL, &csi_ignore},     /* : */
-		[0x3b]          = {param, &csi_param},     /* ; */
-		[0x3c ... 0x3f] = {collect, &csi_param},   /* <=>? */
-		[0x40 ... 0x7e] = {send, &ground}, /* @A-Za-z[\]^_`{|}~ */
-		[0x7f]          = {NULL, NULL},
-	}
+		[0x20 ... 0x2f] = GO(COLLECT, csi_collect), /* !"#$%&'()*+,-./ */
+		[0x30 ... 0x3b] = GO(PARAM, csi_param),     /* 0 - 9 : ; */
+		[0x3c ... 0x3f] = GO(COLLECT, csi_param),   /* <=>? */
+		[0x40 ... 0x7e] = GO(SEND, ground), /* @A-Za-z[\]^_`{|}~ */
+		[0x7f]          = NONE,
+	},
+	[csi_ignore] = {
+		LOWBITS,
+		[0x20 ... 0x3f] = NONE,             /* !"#$%&'()*+,-./0-9... */
+		[0x40 ... 0x7e] = GO(NONE, ground), /* @A-Za-z[\]^_`{|}~ */
+		[0x7f]          = NONE,
+	},
+	[csi_param] = {
+		LOWBITS,
+		[0x20 ... 0x2f] = GO(COLLECT, csi_collect),
+		[0x30 ... 0x3b] = PARAM,                   /* 0 - 9 : ; */
+		[0x3c ... 0x3f] = GO(NONE, csi_ignore),
+		[0x40 ... 0x7e] = GO(SEND, ground),
+		[0x7f]          = NONE,
+	},
+	[csi_collect] = {
+		LOWBITS,
+		[0x20 ... 0x2f] = COLLECT,              /* !"#$%&'()*+,-./ */
+		[0x30 ... 0x3f] = GO(NONE, csi_ignore), /* 0-9 :;<=>? */
+		[0x40 ... 0x7e] = GO(SEND, ground),
+		[0x7f]          = NONE,
+	},
+	[osc_param] = {
+		LOWBITS,
+		[0x07]          = GO(HANDLE_OSC, ground),
+		[0x20 ... 0x7f] = COLLECT_OSC,
+		[0x30 ... 0x39] = PARAM,                /* 0 - 9 */
+		[0x3b]          = GO(PARAM, osc_string), /* ; */
+	},
+	[osc_string] = {
+		LOWBITS,
+		[0x07]          = GO(HANDLE_OSC, ground),
+		[0x0a]          = GO(HANDLE_OSC, ground),  /* \n */
+		[0x0d]          = GO(HANDLE_OSC, ground),  /* \r */
+		[0x20 ... 0x7f] = COLLECT_OSC,
+	},
 };
 
-static struct state csi_ignore = {
-	.reset = 0,
-	.lut = csis,
-	.act = {
-		LOWBITS,
-		[0x20 ... 0x3f] = {NULL, NULL},    /* !"#$%&'()*+,-./0-9... */
-		[0x40 ... 0x7e] = {NULL, &ground}, /* @A-Za-z[\]^_`{|}~ */
-		[0x7f]          = {NULL, NULL},
-	}
+/*
+ * A table driven UTF-8 decoder, after Bjoern Hoehrmann's DFA.  Each
+ * byte is mapped to a class, and the class and the current state give
+ * the next state.  Overlong forms, surrogates and code points above
+ * U+10FFFF are rejected.
+ */
+enum { ASC, C80, C90, CA0, L2, LE0, L3, LED, LF0, L4, LF4, BAD };
+enum { U_ACCEPT, U_REJECT, U_1, U_2, U_3, U_E0, U_ED, U_F0, U_F4 };
+
+static const unsigned char utf8_class[256] = {
+	[0x00 ... 0x7f] = ASC,
+	[0x80 ... 0x8f] = C80,
+	[0x90 ... 0x9f] = C90,
+	[0xa0 ... 0xbf] = CA0,
+	[0xc0 ... 0xc1] = BAD,
+	[0xc2 ... 0xdf] = L2,
+	[0xe0]          = LE0,
+	[0xe1 ... 0xec] = L3,
+	[0xed]          = LED,
+	[0xee ... 0xef] = L3,
+	[0xf0]          = LF0,
+	[0xf1 ... 0xf3] = L4,
+	[0xf4]          = LF4,
+	[0xf5 ... 0xff] = BAD,
 };
 
-static struct state csi_param = {
-	.reset = 0,
-	.lut = csis,
-	.act = {
-		LOWBITS,
-		[0x20 ... 0x2f] = {collect, &csi_collect},
-		[0x30 ... 0x39] = {param, NULL},           /* 0 - 9 */
-		[0x3a]          = {NULL, &csi_ignore},
-		[0x3b]          = {param, NULL},           /* ; */
-		[0x3c ... 0x3f] = {NULL, &csi_ignore},
-		[0x40 ... 0x7e] = {send, &ground},
-		[0x7f]          = {NULL, NULL},
-	}
+/* Bits of a lead byte that contribute to the code point */
+static const unsigned char utf8_mask[BAD + 1] = {
+	[ASC] = 0x7f,
+	[L2] = 0x1f,
+	[LE0] = 0x0f, [L3] = 0x0f, [LED] = 0x0f,
+	[LF0] = 0x07, [L4] = 0x07, [LF4] = 0x07,
 };
 
-static struct state csi_collect = {
-	.reset = 0,
-	.lut = csis,
-	.act = {
-		LOWBITS,
-		[0x20 ... 0x2f] = {collect, NULL},     /* !"#$%&'()*+,-./ */
-		[0x30 ... 0x3f] = {NULL, &csi_ignore}, /* 0-9 :;<=>? */
-		[0x40 ... 0x7e] = {send, &ground},
-		[0x7f]          = {NULL, NULL},
-	}
+static const unsigned char utf8_next[U_F4 + 1][BAD + 1] = {
+	[U_ACCEPT] = {
+		[ASC ... BAD] = U_REJECT,
+		[ASC] = U_ACCEPT,
+		[L2] = U_1,
+		[LE0] = U_E0,
+		[L3] = U_2,
+		[LED] = U_ED,
+		[LF0] = U_F0,
+		[L4] = U_3,
+		[LF4] = U_F4,
+	},
+	[U_REJECT] = { [ASC ... BAD] = U_REJECT },
+	[U_1]  = { [ASC ... BAD] = U_REJECT, [C80 ... CA0] = U_ACCEPT },
+	[U_2]  = { [ASC ... BAD] = U_REJECT, [C80 ... CA0] = U_1 },
+	[U_3]  = { [ASC ... BAD] = U_REJECT, [C80 ... CA0] = U_2 },
+	[U_E0] = { [ASC ... BAD] = U_REJECT, [CA0] = U_1 },
+	[U_ED] = { [ASC ... BAD] = U_REJECT, [C80 ... C90] = U_1 },
+	[U_F0] = { [ASC ... BAD] = U_REJECT, [C90 ... CA0] = U_2 },
+	[U_F4] = { [ASC ... BAD] = U_REJECT, [C80] = U_2 },
 };
 
-#pragma GCC diagnostic ignored "-Woverride-init"
-static struct state osc_param = {
-	.reset = 0,
-	.lut = oscs,
-	.act = {
-		LOWBITS,
-		[0x07]          = {handle_osc, &ground},
-		[0x20 ... 0x7f] = {collect_osc, NULL},
-		[0x30 ... 0x39] = {param, NULL},        /* 0 - 9 */
-		[0x3b]          = {param, &osc_string}, /* ; */
+/*
+ * Decode the byte c.  Return the number of bytes consumed (0 or 1) and
+ * set *w to the decoded character, or to -1 if c is part of an
+ * incomplete character.  An invalid sequence is replaced by a single
+ * VTPARSER_BAD_CHAR, and the byte that ended it is consumed only if it
+ * cannot start a new character.
+ */
+static size_t
+utf8_decode(struct vtp *v, unsigned char c, wchar_t *w)
+{
+	unsigned class = utf8_class[c];
+	unsigned next = utf8_next[v->u][class];
+
+	*w = -1;
+	if (next == U_REJECT) {
+		int partial = v->u != U_ACCEPT;
+		v->u = U_ACCEPT;
+		*w = VTPARSER_BAD_CHAR;
+		return !partial;
 	}
-};
+	v->cp = v->u == U_ACCEPT ? c & utf8_mask[class]
+		: (v->cp << 6) | (c & 0x3f);
+	if ((v->u = next) == U_ACCEPT) {
+		*w = v->cp;
+	}
+	return 1;
+}
 
-static struct state osc_string = {
-	.reset = 0,
-	.lut = oscs,
-	.act = {
-		LOWBITS,
-		[0x07]          = {handle_osc, &ground},
-		[0x0a]          = {handle_osc, &ground},  /* \n */
-		[0x0d]          = {handle_osc, &ground},  /* \r */
-		[0x20 ... 0x7f] = {collect_osc, NULL},
+static int
+is_utf8(void)
+{
+	static int utf8 = -1;
+	if (utf8 == -1) {
+#ifdef __STDC_ISO_10646__
+		utf8 = !strcmp(nl_langinfo(CODESET), "UTF-8");
+#else
+		utf8 = 0;
+#endif
 	}
-};
+	return utf8;
+}
 
+/*
+ * Reset the parameters of the current sequence.  Only the fields that
+ * the previous sequence may have written are cleared: the OSC buffer is
+ * terminated when it is handled and the decoder is always between
+ * characters here, so neither needs to be touched.
+ */
 void
 vtreset(struct vtp *v)
 {
-	memset(&v->inter, 0, sizeof *v - offsetof(struct vtp, inter));
-	v->s = &ground;
+	int n = v->argc < MAXPARAM ? v->argc : MAXPARAM;
+	memset(v->args, 0, n * sizeof *v->args);
+	v->argc = 0;
+	v->group = 0;
+	v->colon = 0;
+	v->inter = 0;
+	v->s = ground;
 	v->osc = v->oscbuf;
 }
 
+/* Return the length of the run of printable ASCII at the start of s */
+static size_t
+ascii_run(const char *s, size_t n)
+{
+	size_t i = 0;
+#ifdef __SSE2__
+	const __m128i lo = _mm_set1_epi8(0x1f);
+	const __m128i hi = _mm_set1_epi8(0x7f);
+	for (; i + 16 <= n; i += 16) {
+		/* Signed compares, so bytes >= 0x80 fail the first test */
+		__m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+		unsigned m = _mm_movemask_epi8(_mm_and_si128(
+			_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi)));
+		if (m != 0xffff) {
+			return i + __builtin_ctz(~m);
+		}
+	}
+#endif
+	while (i < n && (unsigned char)(s[i] - 0x20) < 0x5f) {
+		i += 1;
+	}
+	return i;
+}
+
 void
 vtwrite(struct vtp *vp, const char *s, size_t n)
 {
 	size_t r;
 	for (const char *e = s + n; s < e; s += r) {
 		wchar_t w;
-		switch (r = mbrtowc(&w, s, e - s, &vp->ms)) {
+		if (vp->s == ground && vp->u == U_ACCEPT && mbsinit(&vp->ms)
+				&& (r = ascii_run(s, e - s)) > 0) {
+			struct vtop *o = vtemit(vp, prun);
+			o->run.s = s;
+			o->run.n = r;
+			continue;
+		}
+		if (is_utf8()) {
+			if (r = utf8_decode(vp, *s, &w), w == -1) {
+				continue;
+			}
+		} else switch (r = mbrtowc(&w, s, e - s, &vp->ms)) {
 		case -1: /* invalid character, skip it */
 		case -2: /* incomplete character, skip it */
 			w = VTPARSER_BAD_CHAR;
@@ -239,18 +436,27 @@ vtwrite(struct vtp *vp, const char *s, size_t n)
 			r = 1;
 		}
 		if (w >= 0 && w < 0x80) {
-			struct action *a = vp->s->act + w;
-			if (a->cb) {
-				a->cb(vp, w);
+			unsigned a = table[vp->s][w];
+			switch ((enum action)(a & 7)) {
+			case NONE: break;
+			case SEND: send(vp, w); break;
+			case COLLECT: collect(vp, w); break;
+			case COLLECT_OSC: collect_osc(vp, w); break;
+			case PARAM: param(vp, w); break;
+			case HANDLE_OSC: handle_osc(vp); break;
 			}
-			if (a->next) {
-				if (a->next->reset) {
+			if (a >>= 3) {
+				if (resets & 1 << (a - 1)) {
 					vtreset(vp);
 				}
-				vp->s = a->next;
+				vp->s = a - 1;
 			}
 		} else {
-			tput(vp->p, w, 0, 0, NULL, print);
+			struct vtop *o = vtemit(vp, print);
+			o->w = w;
+			o->iw = 0;
+			o->argc = 0;
 		}
 	}
+	vtflush(vp);
 }
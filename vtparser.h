@@ -50,6 +50,7 @@ enum cmd {
 	osc,          /* Operating System Command */
 	pnl,          /* Newline */
 	print,        /* Print a character to the terminal */
+	prun,         /* Print a run of printable ASCII */
 	rc,           /* Restore Cursor */
 	rep,          /* Repeat Character */
 	ri,           /* Reverse Index (scroll back) */
@@ -88,16 +89,48 @@ The following are unimplemented:
 #define MAXPARAM    16
 #define MAXOSC      511
 
+/*
+ * The parser emits a stream of operations rather than changing the screen
+ * itself.  Operations are queued in the struct vtp and handed to a
+ * consumer in batches: when the queue fills, before an OSC is handled,
+ * and before vtwrite returns.  The consumer is vtapply, which applies
+ * each one with tput, unless another is installed in apply.  The text of
+ * a prun points into the buffer given to vtwrite, so a consumer that
+ * keeps operations past the call must copy it.
+ */
+#define VTOPS 64
+
+struct vtop {
+	int cmd;            /* enum cmd */
+	int argc;
+	wchar_t w;
+	wchar_t iw;
+	union {
+		int args[MAXPARAM];
+		struct {
+			const char *s;
+			size_t n;
+		} run;
+	};
+};
+
 struct pty;
 struct vtp {
 	struct pty *p;
-	struct state *s;
+	unsigned char s;    /* Parser state */
 	wchar_t inter;
 	int argc;
 	int args[MAXPARAM];
+	int group;          /* Index of the first arg of the current group */
+	int colon;          /* The current group has subparameters */
 	char oscbuf[MAXOSC + 1];
 	char *osc;
 	mbstate_t ms;
+	unsigned char u;    /* UTF-8 decoder state */
+	wchar_t cp;         /* Partially decoded code point */
+	struct vtop ops[VTOPS]; /* Operations not yet applied */
+	int nops;
+	void (*apply)(struct pty *, struct vtop *, int); /* NULL for vtapply */
 };
 extern int cons[0x80];
 extern int csis[0x80];
@@ -107,9 +140,12 @@ extern int gnds[0x80];
 
 extern void set_status(struct pty *p, const char *arg);
 extern void tput(struct pty *, wchar_t, wchar_t, int, int *, int);
+extern void tprint(struct pty *, const char *, size_t);
 extern void vtreset(struct vtp *v);
+extern void vtapply(struct pty *, struct vtop *, int);
 extern void vtwrite(struct vtp *vp, const char *s, size_t n);
 extern int build_layout(const char *);
+extern void run_later(struct pty *, void (*)(const char *), const char *);
 
 /* Debugging/test harness */
 #ifndef NDEBUG
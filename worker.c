@@ -0,0 +1,179 @@
+/*
+ * Copyright 2020 - 2023 William Pursell <william.r.pursell@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A pool of threads that parse the output of several ptys at once.
+ * The main thread hands out a batch of jobs, one per ready pty, takes
+ * jobs itself, and returns only when every job is done.  While a batch
+ * runs, each pty and its screens belong to the one thread that claimed
+ * it, and nothing draws: the main thread picks up the changed rows of
+ * every pty at the next frame, after the batch has joined.  Jobs are
+ * claimed with an atomic counter; the lock is only used to sleep and
+ * wake.  Work that must stay on the main thread is left in the pty by
+ * run_later.
+ */
+#include "smtx.h"
+#if HAVE_PTHREAD
+# include <pthread.h>
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t go, done;
+	void (*f)(void *);
+	void **arg;
+	int n;        /* Jobs in the batch */
+	int next;     /* Index of the next job to claim */
+	int active;   /* Threads other than main working on the batch */
+	unsigned gen; /* Incremented for each batch */
+} pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.go = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+};
+static int nthreads = 1;
+
+static void
+claim_jobs(void)
+{
+	int i;
+	while ((i = __atomic_fetch_add(&pool.next, 1, __ATOMIC_RELAXED))
+			< pool.n) {
+		pool.f(pool.arg[i]);
+	}
+}
+
+static void *
+worker(void *arg)
+{
+	unsigned gen = 0;
+	(void)arg;
+	pthread_mutex_lock(&pool.lock);
+	for (;;) {
+		while (pool.gen == gen) {
+			pthread_cond_wait(&pool.go, &pool.lock);
+		}
+		gen = pool.gen;
+		/* Join only a batch that main is still waiting on */
+		if (__atomic_load_n(&pool.next, __ATOMIC_RELAXED) < pool.n) {
+			pool.active += 1;
+			pthread_mutex_unlock(&pool.lock);
+			claim_jobs();
+			pthread_mutex_lock(&pool.lock);
+			if (--pool.active == 0) {
+				pthread_cond_signal(&pool.done);
+			}
+		}
+	}
+	return NULL;
+}
+
+/* Start threads so that n threads, including main, run each batch */
+int
+pool_init(int n)
+{
+	sigset_t all, old;
+	pthread_t t;
+	int e = 0;
+	/* Signals are read by the main thread from the event loop */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	for (; nthreads < n && (e = pthread_create(&t, NULL, worker,
+			NULL)) == 0; nthreads++) {
+		pthread_detach(t);
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	return check(e == 0, e, "pthread_create");
+}
+
+/* Call f on each of the n elements of arg, in parallel */
+void
+pool_run(void (*f)(void *), void **arg, int n)
+{
+	if (nthreads < 2 || n < 2) {
+		for (int i = 0; i < n; i++) {
+			f(arg[i]);
+		}
+		return;
+	}
+	pthread_mutex_lock(&pool.lock);
+	pool.f = f;
+	pool.arg = arg;
+	pool.n = n;
+	pool.next = 0;
+	pool.gen += 1;
+	pthread_cond_broadcast(&pool.go);
+	pthread_mutex_unlock(&pool.lock);
+
+	claim_jobs();
+
+	/*
+	 * Every job has been claimed, so wait for those still running.
+	 * A thread that wakes from now on sees no job left, and does not
+	 * touch the batch.
+	 */
+	pthread_mutex_lock(&pool.lock);
+	while (pool.active > 0) {
+		pthread_cond_wait(&pool.done, &pool.lock);
+	}
+	pthread_mutex_unlock(&pool.lock);
+}
+#else
+int
+pool_init(int n)
+{
+	return check(n < 2, errno = 0, "threads are not supported");
+}
+
+void
+pool_run(void (*f)(void *), void **arg, int n)
+{
+	for (int i = 0; i < n; i++) {
+		f(arg[i]);
+	}
+}
+#endif
+
+/*
+ * Make a call that the parser of p asked for, now if p is parsed on
+ * the main thread, or else when its batch is done, since f may draw or
+ * change other ptys.
+ */
+void
+run_later(struct pty *p, action *f, const char *arg)
+{
+	if (!S.parallel) {
+		f(arg);
+	} else if (!buf_append(&p->later, (const char *)&f, sizeof f)
+			|| !buf_append(&p->later, arg, strlen(arg) + 1)) {
+		p->later.len = 0;
+	}
+}
+
+/* Make the calls left in p by run_later */
+void
+flush_later(struct pty *p)
+{
+	struct buf *b = &p->later;
+	while (b->off < b->len) {
+		action *f;
+		memcpy(&f, b->b + b->off, sizeof f);
+		b->off += sizeof f;
+		f(b->b + b->off);
+		b->off += strlen(b->b + b->off) + 1;
+	}
+	b->off = b->len = 0;
+}